@@ -0,0 +1,61 @@
+#ifndef CME212_BENCH_GRAPHTRAITS_HPP
+#define CME212_BENCH_GRAPHTRAITS_HPP
+
+/** @file GraphTraits.hpp
+ * @brief Detection of the optional parts of the Graph interface
+ *
+ * The hw0, hw1 and hw2 Graphs share a core (add_node, add_edge, has_edge,
+ * node(i), edge(i)) but differ in the rest. The benchmarks use these traits
+ * with if constexpr so one source compiles against every variant.
+ */
+
+#include <type_traits>
+#include <utility>
+
+template <typename G, typename = void>
+struct has_node_values : std::false_type {};
+template <typename G>
+struct has_node_values<G, std::void_t<decltype(std::declval<typename G::node_type&>().value())>>
+    : std::true_type {};
+
+template <typename G, typename = void>
+struct has_edge_values : std::false_type {};
+template <typename G>
+struct has_edge_values<G, std::void_t<decltype(std::declval<typename G::edge_type&>().value())>>
+    : std::true_type {};
+
+template <typename G, typename = void>
+struct has_incident : std::false_type {};
+template <typename G>
+struct has_incident<G, std::void_t<decltype(std::declval<typename G::node_type&>().edge_begin())>>
+    : std::true_type {};
+
+template <typename G, typename = void>
+struct has_edge_iterator : std::false_type {};
+template <typename G>
+struct has_edge_iterator<G, std::void_t<decltype(std::declval<const G&>().edge_begin())>>
+    : std::true_type {};
+
+template <typename G, typename = void>
+struct has_remove_node : std::false_type {};
+template <typename G>
+struct has_remove_node<G, std::void_t<decltype(std::declval<G&>().remove_node(
+    std::declval<typename G::node_type>()))>> : std::true_type {};
+
+/** Graphs that keep removed nodes, and their indices, until they compact. */
+template <typename G, typename = void>
+struct has_node_index_end : std::false_type {};
+template <typename G>
+struct has_node_index_end<G, std::void_t<decltype(std::declval<const G&>().node_index_end())>>
+    : std::true_type {};
+
+/** One past the largest node index of @a g. */
+template <typename G>
+auto node_index_end(const G& g) {
+  if constexpr (has_node_index_end<G>::value)
+    return g.node_index_end();
+  else
+    return g.num_nodes();
+}
+
+#endif // CME212_BENCH_GRAPHTRAITS_HPP
@@ -0,0 +1,82 @@
+#!/usr/bin/env bash
+#
+# Check that restarting the mass-spring driver from a checkpoint is bit
+# exact: for every solver, a continuous run and a run checkpointed halfway
+# and restarted must print the same position hash. The mesh is a cloth that
+# the sphere constraint tears before the checkpoint, so the restarted graph
+# holds removed nodes and edges.
+#
+# Usage: bench/check_restart.sh [GRAPH_HEADER]
+#
+#   GRAPH_HEADER    Graph implementation the driver is built with
+#                   (default hw2/Graph_1a8706063c5a.hpp)
+#
+# Environment:
+#   CME212_INCLUDE  directory holding CME212/Point.hpp, CME212/Util.hpp and
+#                   CME212/SFML_Viewer.hpp (required)
+#   CXX, CXXFLAGS   compiler and flags (default g++, -std=c++17 -O2)
+#   LDLIBS          libraries the viewer links against (default none)
+#   SIDE            cloth cells per side (default 24, i.e. 625 nodes)
+#   STEPS           steps of the continuous run (default 3000)
+#   OUT             output directory (default bench_out)
+#
+# Prints one line per solver, ok or FAIL with both hashes; the exit status
+# is 1 if any solver fails or if no nodes were removed before the
+# checkpoint.
+
+set -u
+cd "$(dirname "$0")/.."
+
+HEADER=${1:-hw2/Graph_1a8706063c5a.hpp}
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:-"-std=c++17 -O2"}
+LDLIBS=${LDLIBS:-}
+SIDE=${SIDE:-24}
+STEPS=${STEPS:-3000}
+OUT=${OUT:-bench_out}
+
+if [ -z "${CME212_INCLUDE:-}" ]; then
+  echo "Set CME212_INCLUDE to the directory holding CME212/Point.hpp" >&2
+  exit 2
+fi
+DIR="$OUT/restart"
+mkdir -p "$DIR/include"
+cp "$HEADER" "$DIR/include/Graph.hpp"
+
+# The driver and the mesh generator include "Graph.hpp"
+for prog in mass_spring_02437ff26dbc mesh_gen; do
+  if ! $CXX $CXXFLAGS -pthread -I"$DIR/include" -Ihw2 -I"$CME212_INCLUDE" \
+         "hw2/$prog.cpp" -o "$DIR/$prog" $LDLIBS 2> "$DIR/$prog.build"; then
+    echo "cannot build $prog, see $DIR/$prog.build" >&2
+    exit 2
+  fi
+done
+MS="$DIR/mass_spring_02437ff26dbc"
+"$DIR/mesh_gen" cloth "$SIDE" "$DIR/cloth" > /dev/null || exit 2
+
+hash() { awk '$1 == "position" && $2 == "hash" { print $3 }'; }
+
+status=0
+for solver in euler batch fused pbd pbd-jacobi; do
+  full=$("$MS" "$DIR/cloth.nodes" "$DIR/cloth.tets" --headless="$STEPS" \
+           --solver="$solver" | hash)
+  "$MS" "$DIR/cloth.nodes" "$DIR/cloth.tets" --headless=$((STEPS / 2)) \
+        --solver="$solver" --checkpoint="$DIR/$solver.ckpt" \
+        --checkpoint-every=$((STEPS / 2)) > /dev/null
+  run=$("$MS" --restart="$DIR/$solver.ckpt" --headless="$STEPS")
+  restarted=$(echo "$run" | hash)
+
+  # The first line is the node count of the restored graph
+  nodes=$(echo "$run" | awk 'NR == 1 { print $1 }')
+  if [ "$nodes" -ge $(( (SIDE + 1) * (SIDE + 1) )) ]; then
+    echo "$solver: no nodes removed before the checkpoint" >&2
+    status=1
+  fi
+  if [ -n "$full" ] && [ "$full" = "$restarted" ]; then
+    printf '%-12s ok   %s\n' "$solver" "$full"
+  else
+    printf '%-12s FAIL %s restarted %s\n' "$solver" "$full" "$restarted"
+    status=1
+  fi
+done
+exit $status
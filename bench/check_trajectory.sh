@@ -0,0 +1,123 @@
+#!/usr/bin/env bash
+#
+# Check that trajectories written by the mass-spring driver read back with
+# TrajectoryReader, through the hw2/traj_dump tool. The mesh is a cloth that
+# the sphere constraint tears, so the files hold several topology records.
+#
+#   raw     a float64 trajectory of every step has one frame per step, and
+#           its last frame hashes to the position hash the driver prints
+#   delta   a delta-compressed trajectory matches the raw one to within
+#           half the quantum, and every keyframe decodes the same through
+#           the keyframe index as when read in order
+#   float32 a float32 trajectory matches the raw one frame for frame
+#
+# Usage: bench/check_trajectory.sh [GRAPH_HEADER]
+#
+#   GRAPH_HEADER    Graph implementation the driver is built with
+#                   (default hw2/Graph_1a8706063c5a.hpp)
+#
+# Environment:
+#   CME212_INCLUDE  directory holding CME212/Point.hpp, CME212/Util.hpp and
+#                   CME212/SFML_Viewer.hpp (required)
+#   CXX, CXXFLAGS   compiler and flags (default g++, -std=c++17 -O2)
+#   LDLIBS          libraries the viewer links against (default none)
+#   SIDE            cloth cells per side (default 24, i.e. 625 nodes)
+#   STEPS           steps of the run (default 600)
+#   QUANTUM         quantum of the delta-compressed file (default 1e-6)
+#   OUT             output directory (default bench_out)
+#
+# Prints one line per check, ok or FAIL; the exit status is 1 if any check
+# fails or if no nodes were removed during the run.
+
+set -u
+cd "$(dirname "$0")/.."
+
+HEADER=${1:-hw2/Graph_1a8706063c5a.hpp}
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:-"-std=c++17 -O2"}
+LDLIBS=${LDLIBS:-}
+SIDE=${SIDE:-24}
+STEPS=${STEPS:-600}
+QUANTUM=${QUANTUM:-1e-6}
+OUT=${OUT:-bench_out}
+
+if [ -z "${CME212_INCLUDE:-}" ]; then
+  echo "Set CME212_INCLUDE to the directory holding CME212/Point.hpp" >&2
+  exit 2
+fi
+DIR="$OUT/trajectory"
+mkdir -p "$DIR/include"
+cp "$HEADER" "$DIR/include/Graph.hpp"
+
+# The driver and the mesh generator include "Graph.hpp"; traj_dump reads
+# the files back
+for prog in mass_spring_02437ff26dbc mesh_gen traj_dump; do
+  libs=""
+  [ "$prog" = mass_spring_02437ff26dbc ] && libs=$LDLIBS
+  if ! $CXX $CXXFLAGS -pthread -I"$DIR/include" -Ihw2 -I"$CME212_INCLUDE" \
+         "hw2/$prog.cpp" -o "$DIR/$prog" $libs 2> "$DIR/$prog.build"; then
+    echo "cannot build $prog, see $DIR/$prog.build" >&2
+    exit 2
+  fi
+done
+MS="$DIR/mass_spring_02437ff26dbc"
+DUMP="$DIR/traj_dump"
+"$DIR/mesh_gen" cloth "$SIDE" "$DIR/cloth" > /dev/null || exit 2
+
+status=0
+result() {
+  if [ "$2" = ok ]; then
+    printf '%-8s ok   %s\n' "$1" "$3"
+  else
+    printf '%-8s FAIL %s\n' "$1" "$3"
+    status=1
+  fi
+}
+run() {
+  "$MS" "$DIR/cloth.nodes" "$DIR/cloth.tets" --headless="$STEPS" \
+        --trajectory="$DIR/$1.traj" --trajectory-vel "${@:2}"
+}
+
+# raw: one frame per step, the last one hashing like the driver
+expected=$(run raw | awk '$1 == "position" && $2 == "hash" { print $3 }')
+frames=$("$DUMP" "$DIR/raw.traj")
+count=$(echo "$frames" | grep -c '^frame')
+last=$(echo "$frames" | tail -n 1)
+hash=$(echo "$last" | awk '{ print $8 }')
+nodes=$(echo "$last" | awk '{ print $6 }')
+if [ "$nodes" -ge $(( (SIDE + 1) * (SIDE + 1) )) ]; then
+  echo "no nodes removed during the run" >&2
+  status=1
+fi
+if [ "$count" -eq "$STEPS" ] && [ -n "$expected" ] && [ "$hash" = "$expected" ]; then
+  result raw ok "$count frames, last hash $hash"
+else
+  result raw FAIL "$count frames, last hash $hash, driver $expected"
+fi
+
+# delta: within half the quantum of the raw file, keyframes seekable
+run delta --trajectory-delta --trajectory-quantum="$QUANTUM" \
+    --trajectory-keyframe=50 > /dev/null
+cmp=$("$DUMP" "$DIR/delta.traj" --compare="$DIR/raw.traj")
+if [ $? -eq 0 ] && echo "$cmp" | awk -v q="$QUANTUM" \
+     '{ exit !($5 <= q / 2 * (1 + 1e-9) && $8 <= q / 2 * (1 + 1e-9)) }'; then
+  result delta ok "$cmp"
+else
+  result delta FAIL "$cmp"
+fi
+keys=$("$DUMP" "$DIR/delta.traj" --keyframes)
+if [ $? -eq 0 ]; then
+  result seek ok "$keys"
+else
+  result seek FAIL "$keys"
+fi
+
+# float32: the same frames and nodes as the raw file
+run float32 --trajectory-f32 > /dev/null
+cmp=$("$DUMP" "$DIR/float32.traj" --compare="$DIR/raw.traj")
+if [ $? -eq 0 ]; then
+  result float32 ok "$cmp"
+else
+  result float32 FAIL "$cmp"
+fi
+exit $status
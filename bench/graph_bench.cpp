@@ -0,0 +1,186 @@
+/**
+ * @file graph_bench.cpp
+ * Throughput of one Graph implementation on a common mesh workload
+ *
+ * @brief The implementation is chosen when compiling:
+ *   g++ -std=c++17 -O2 -I. -ICME212_DIR -DGRAPH_HEADER='"hw2/Graph_x.hpp"'
+ *       -DGRAPH_ARGS='<int,int>' bench/graph_bench.cpp
+ * GRAPH_ARGS is empty for a plain Graph (hw0), <int> for Graph<V> (hw1)
+ * and <int,int> for Graph<V,E> (hw2). run_graph_bench.sh does this for
+ * every variant and ranks them.
+ *
+ * Usage: graph_bench [SIDE]
+ * The workload is a SIDE^3 lattice (default 30) with edges to the +x, +y,
+ * +z and +xy neighbours. Prints one line per operation,
+ *   op NAME SECONDS COUNT
+ * where COUNT is the number of calls timed, "skip NAME" for operations the
+ * implementation does not provide, and "check" lines comparing the graph
+ * with the expected mesh.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include GRAPH_HEADER
+
+#include "GraphTraits.hpp"
+
+#ifndef GRAPH_ARGS
+#define GRAPH_ARGS
+#endif
+
+using GraphType = Graph GRAPH_ARGS;
+
+// Keeps results alive so the timed loops are not optimized away
+static volatile std::uint64_t sink;
+
+/** Run @a fn once and print its time as operation @a name of @a count calls. */
+template <typename F>
+void timed(const char* name, std::uint64_t count, F fn) {
+  auto start = std::chrono::steady_clock::now();
+  std::uint64_t r = fn();
+  std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+  sink = sink + r;
+  std::cout << "op " << name << " " << t.count() << " " << count << std::endl;
+}
+
+/** Run the workload on a SIDE^3 lattice in a graph of type G. */
+template <typename G>
+void run_workload(unsigned side) {
+  using Node = typename G::node_type;
+  unsigned n = side * side * side;
+  auto id = [side](unsigned x, unsigned y, unsigned z) { return (z * side + y) * side + x; };
+
+  // Lattice edges
+  std::vector<std::pair<unsigned, unsigned>> pairs;
+  for (unsigned z = 0; z < side; ++z)
+    for (unsigned y = 0; y < side; ++y)
+      for (unsigned x = 0; x < side; ++x) {
+        unsigned i = id(x, y, z);
+        if (x + 1 < side) pairs.emplace_back(i, id(x+1, y, z));
+        if (y + 1 < side) pairs.emplace_back(i, id(x, y+1, z));
+        if (z + 1 < side) pairs.emplace_back(i, id(x, y, z+1));
+        if (x + 1 < side && y + 1 < side) pairs.emplace_back(i, id(x+1, y+1, z));
+      }
+  std::mt19937 rng(212);
+  std::vector<std::pair<unsigned, unsigned>> misses;
+  std::uniform_int_distribution<unsigned> any(0, n - 1);
+  while (misses.size() < pairs.size()) {
+    unsigned a = any(rng), b = any(rng);
+    if (a != b)
+      misses.emplace_back(a, b);
+  }
+
+  G g;
+  std::vector<Node> nodes;
+  nodes.reserve(n);
+
+  timed("add_node", n, [&]() {
+    for (unsigned z = 0; z < side; ++z)
+      for (unsigned y = 0; y < side; ++y)
+        for (unsigned x = 0; x < side; ++x)
+          nodes.push_back(g.add_node(Point(x, y, z)));
+    return std::uint64_t(g.num_nodes());
+  });
+
+  // Every edge twice, the second time reversed, as tet meshes do
+  timed("add_edge", 2 * pairs.size(), [&]() {
+    for (auto& p : pairs)
+      g.add_edge(nodes[p.first], nodes[p.second]);
+    for (auto& p : pairs)
+      g.add_edge(nodes[p.second], nodes[p.first]);
+    return std::uint64_t(g.num_edges());
+  });
+  std::cout << "check nodes " << g.num_nodes() << " " << n << "\n"
+            << "check edges " << g.num_edges() << " " << pairs.size() << std::endl;
+
+  timed("has_edge", 2 * pairs.size(), [&]() {
+    std::uint64_t hits = 0;
+    for (auto& p : pairs)
+      hits += g.has_edge(nodes[p.second], nodes[p.first]);
+    for (auto& p : misses)
+      hits += g.has_edge(nodes[p.first], nodes[p.second]);
+    return hits;
+  });
+
+  timed("edge_index", g.num_edges(), [&]() {
+    std::uint64_t s = 0;
+    for (unsigned i = 0; i < g.num_edges(); ++i)
+      s += g.edge(i).node1().index();
+    return s;
+  });
+
+  if constexpr (has_edge_iterator<G>::value) {
+    timed("edge_iter", g.num_edges(), [&]() {
+      std::uint64_t s = 0;
+      for (auto it = g.edge_begin(); it != g.edge_end(); ++it)
+        s += (*it).node2().index();
+      return s;
+    });
+  }
+  else
+    std::cout << "skip edge_iter" << std::endl;
+
+  if constexpr (has_incident<G>::value) {
+    timed("incident_iter", 2 * g.num_edges(), [&]() {
+      std::uint64_t s = 0;
+      for (auto& a : nodes)
+        for (auto it = a.edge_begin(); it != a.edge_end(); ++it)
+          s += (*it).node2().index();
+      return s;
+    });
+  }
+  else
+    std::cout << "skip incident_iter" << std::endl;
+
+  if constexpr (has_node_values<G>::value) {
+    timed("node_value", 2 * std::uint64_t(n), [&]() {
+      for (auto& a : nodes)
+        a.value() = a.index();
+      std::uint64_t s = 0;
+      for (auto& a : nodes)
+        s += a.value();
+      return s;
+    });
+  }
+  else
+    std::cout << "skip node_value" << std::endl;
+
+  if constexpr (has_edge_values<G>::value && has_edge_iterator<G>::value) {
+    timed("edge_value", g.num_edges(), [&]() {
+      std::uint64_t s = 0;
+      for (auto it = g.edge_begin(); it != g.edge_end(); ++it)
+        s += (*it).value();
+      return s;
+    });
+  }
+  else
+    std::cout << "skip edge_value" << std::endl;
+
+  // A tenth of the nodes, spread over the mesh
+  if constexpr (has_remove_node<G>::value) {
+    unsigned removals = n / 10;
+    timed("remove_node", removals, [&]() {
+      for (unsigned k = 0; k < removals && g.num_nodes() > 0; ++k) {
+        unsigned i = (7919u * k) % node_index_end(g);
+        if constexpr (has_node_index_end<G>::value)   // next node not removed yet
+          while (!g.has_node(g.node(i)))
+            i = (i + 1) % node_index_end(g);
+        g.remove_node(g.node(i));
+      }
+      return std::uint64_t(g.num_nodes());
+    });
+  }
+  else
+    std::cout << "skip remove_node" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  run_workload<GraphType>(argc > 1 ? std::stoul(argv[1]) : 30);
+  return 0;
+}
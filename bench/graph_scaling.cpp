@@ -0,0 +1,265 @@
+/**
+ * @file graph_scaling.cpp
+ * Empirical check of the documented complexity of one Graph implementation
+ *
+ * @brief Compiled like graph_bench.cpp:
+ *   g++ -std=c++17 -O2 -I. -ICME212_DIR -DGRAPH_HEADER='"hw2/Graph_x.hpp"'
+ *       -DGRAPH_ARGS='<int,int>' bench/graph_scaling.cpp
+ *
+ * Usage: graph_scaling [--max N] [--budget SECONDS] [--slack X] [--bound OP=EXP]...
+ *
+ * Builds lattice meshes (edges to the +x, +y, +z and +xy neighbours, so the
+ * degree is bounded) of 10^3, 10^3.5, ... nodes up to --max (default 10^7)
+ * and measures the time per call of each operation at each size. The growth
+ * exponent of the time per call is fitted by least squares on log-log axes
+ * and compared with the bound documented in the Graph interface:
+ *
+ *   add_node, node(i)            O(1) amortized          exponent 0
+ *   has_edge, add_edge, edge(i)  O(num_nodes() + num_edges())         1
+ *   remove_node                  O(num_nodes() + num_edges())         1
+ *   iterator increments          O(1)                                 0
+ *
+ * Variants documenting a tighter bound are checked against it with
+ * --bound, e.g. --bound has_edge=0. An exponent above bound + slack
+ * (default 0.3, room for cache effects) fails. Sizes stop growing once the
+ * next one is predicted to take longer than --budget seconds (default 60).
+ *
+ * Prints
+ *   op NAME NODES SECONDS_PER_CALL CALLS     for every measurement
+ *   fit NAME EXPONENT BOUND ok|FAIL          for every operation
+ *   stop NODES PREDICTED_SECONDS             if the budget ended the sizes
+ * and exits with status 1 if any operation fails its bound.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include GRAPH_HEADER
+
+#include "GraphTraits.hpp"
+
+#ifndef GRAPH_ARGS
+#define GRAPH_ARGS
+#endif
+
+using GraphType = Graph GRAPH_ARGS;
+
+/** Documented bound of an operation: exponent of its time per call in the
+ * number of nodes of a bounded-degree mesh. */
+struct Bound {
+  const char* op;
+  double exponent;
+};
+
+static const Bound documented[] = {
+  {"add_node", 0}, {"node", 0}, {"add_edge", 1}, {"has_edge", 1}, {"edge", 1},
+  {"edge_iter", 0}, {"incident_iter", 0}, {"remove_node", 1},
+};
+
+// Keeps results alive so the timed loops are not optimized away
+static volatile std::uint64_t sink;
+
+using clock_type = std::chrono::steady_clock;
+
+static double seconds_since(clock_type::time_point start) {
+  return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+/** Measurements: op -> (nodes, seconds per call) */
+using Series = std::map<std::string, std::vector<std::pair<double, double>>>;
+
+/** Run @a fn, which makes @a calls calls, @a reps times and record the
+ * fastest time per call as operation @a name at @a nodes nodes. */
+template <typename F>
+void timed(Series& series, const char* name, std::uint64_t nodes,
+           std::uint64_t calls, int reps, F fn) {
+  double best = HUGE_VAL;
+  for (int r = 0; r < reps; ++r) {
+    auto start = clock_type::now();
+    sink = sink + fn();
+    best = std::min(best, seconds_since(start));
+  }
+  double per_call = best / std::max<std::uint64_t>(calls, 1);
+  series[name].emplace_back(double(nodes), per_call);
+  std::cout << "op " << name << " " << nodes << " " << per_call << " " << calls << std::endl;
+}
+
+/** Measure every operation on a SIDE^3 lattice in a graph of type G. */
+template <typename G>
+void measure(Series& series, unsigned side) {
+  std::uint64_t n = std::uint64_t(side) * side * side;
+  auto id = [side](unsigned x, unsigned y, unsigned z) { return (z * side + y) * side + x; };
+
+  std::vector<std::pair<unsigned, unsigned>> pairs;
+  for (unsigned z = 0; z < side; ++z)
+    for (unsigned y = 0; y < side; ++y)
+      for (unsigned x = 0; x < side; ++x) {
+        unsigned i = id(x, y, z);
+        if (x + 1 < side) pairs.emplace_back(i, id(x+1, y, z));
+        if (y + 1 < side) pairs.emplace_back(i, id(x, y+1, z));
+        if (z + 1 < side) pairs.emplace_back(i, id(x, y, z+1));
+        if (x + 1 < side && y + 1 < side) pairs.emplace_back(i, id(x+1, y+1, z));
+      }
+
+  // Per-call samples are contiguous blocks from the middle of the mesh, so
+  // their cache footprint does not grow with the mesh
+  std::uint64_t k = std::min<std::uint64_t>(n / 2, 1 << 14);
+  std::uint64_t mid = n / 2 - k / 2;
+  std::uint64_t emid = pairs.size() / 2 - std::min<std::uint64_t>(pairs.size() / 2, k) / 2;
+  std::uint64_t ek = std::min<std::uint64_t>(pairs.size() - emid, k);
+
+  G g;
+  timed(series, "add_node", n, n, 1, [&]() {
+    for (unsigned z = 0; z < side; ++z)
+      for (unsigned y = 0; y < side; ++y)
+        for (unsigned x = 0; x < side; ++x)
+          g.add_node(Point(x, y, z));
+    return std::uint64_t(g.num_nodes());
+  });
+  timed(series, "add_edge", n, pairs.size(), 1, [&]() {
+    for (auto& p : pairs)
+      g.add_edge(g.node(p.first), g.node(p.second));
+    return std::uint64_t(g.num_edges());
+  });
+
+  timed(series, "node", n, k, 5, [&]() {
+    double s = 0;
+    for (std::uint64_t i = mid; i < mid + k; ++i)
+      s += g.node(i).position().x;
+    return std::uint64_t(s);
+  });
+
+  // Hits, reversed, then misses two nodes along the same row
+  timed(series, "has_edge", n, 2 * ek, 5, [&]() {
+    std::uint64_t hits = 0;
+    for (std::uint64_t e = emid; e < emid + ek; ++e)
+      hits += g.has_edge(g.node(pairs[e].second), g.node(pairs[e].first));
+    for (std::uint64_t e = emid; e < emid + ek; ++e)
+      hits += g.has_edge(g.node(pairs[e].first), g.node((pairs[e].first + 2) % n));
+    return hits;
+  });
+
+  timed(series, "edge", n, ek, 5, [&]() {
+    std::uint64_t s = 0;
+    for (std::uint64_t e = emid; e < emid + ek; ++e)
+      s += g.edge(e).node1().index();
+    return s;
+  });
+
+  if constexpr (has_edge_iterator<G>::value) {
+    timed(series, "edge_iter", n, g.num_edges(), 3, [&]() {
+      std::uint64_t s = 0;
+      for (auto it = g.edge_begin(); it != g.edge_end(); ++it)
+        s += (*it).node2().index();
+      return s;
+    });
+  }
+
+  if constexpr (has_incident<G>::value) {
+    timed(series, "incident_iter", n, 2 * g.num_edges(), 3, [&]() {
+      std::uint64_t s = 0;
+      for (std::uint64_t i = 0; i < g.num_nodes(); ++i) {
+        auto a = g.node(i);
+        for (auto it = a.edge_begin(); it != a.edge_end(); ++it)
+          s += (*it).node2().index();
+      }
+      return s;
+    });
+  }
+
+  if constexpr (has_remove_node<G>::value) {
+    // Downwards from the middle: removing a node leaves the indices below
+    // it alone, whether the Graph renumbers or keeps removed nodes
+    std::uint64_t removals = std::min<std::uint64_t>(n / 10, 1 << 10);
+    timed(series, "remove_node", n, removals, 1, [&]() {
+      for (std::uint64_t r = 0; r < removals; ++r)
+        g.remove_node(g.node(n / 2 - r));
+      return std::uint64_t(g.num_nodes());
+    });
+  }
+}
+
+/** Least-squares slope of log(seconds per call) against log(nodes). */
+double fit_exponent(const std::vector<std::pair<double, double>>& pts) {
+  double sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for (auto& p : pts) {
+    double x = std::log(p.first), y = std::log(std::max(p.second, 1e-12));
+    sx += x; sy += y; sxx += x * x; sxy += x * y;
+  }
+  double m = pts.size();
+  return (m * sxy - sx * sy) / (m * sxx - sx * sx);
+}
+
+int main(int argc, char** argv) {
+  double max_nodes = 1e7, budget = 60, slack = 0.3;
+  std::map<std::string, double> bound;
+  for (auto& b : documented)
+    bound[b.op] = b.exponent;
+
+  for (int a = 1; a < argc; ++a) {
+    std::string arg = argv[a];
+    if (a + 1 < argc && arg == "--max")
+      max_nodes = std::stod(argv[++a]);
+    else if (a + 1 < argc && arg == "--budget")
+      budget = std::stod(argv[++a]);
+    else if (a + 1 < argc && arg == "--slack")
+      slack = std::stod(argv[++a]);
+    else if (a + 1 < argc && arg == "--bound") {
+      std::string b = argv[++a];
+      auto eq = b.find('=');
+      if (eq == std::string::npos || !bound.count(b.substr(0, eq))) {
+        std::cerr << "Unknown bound " << b << std::endl;
+        return 2;
+      }
+      bound[b.substr(0, eq)] = std::stod(b.substr(eq + 1));
+    }
+    else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--max N] [--budget SECONDS] [--slack X] [--bound OP=EXP]..." << std::endl;
+      return 2;
+    }
+  }
+
+  // Half-decade sizes. The next size is predicted to cost the last one
+  // times the ratio of their sizes, or times the growth between the two
+  // sizes before if that was larger.
+  Series series;
+  double last = 0, before = 0;
+  std::uint64_t last_n = 0;
+  for (double target = 1e3; target <= max_nodes * 1.0001; target *= std::sqrt(10.0)) {
+    unsigned side = unsigned(std::lround(std::cbrt(target)));
+    std::uint64_t n = std::uint64_t(side) * side * side;
+    if (last_n) {
+      double predicted = last * std::max(double(n) / last_n, before > 1e-3 ? last / before : 0.0);
+      if (predicted > budget) {
+        std::cout << "stop " << n << " " << predicted << std::endl;
+        break;
+      }
+    }
+    auto start = clock_type::now();
+    measure<GraphType>(series, side);
+    before = last;
+    last = seconds_since(start);
+    last_n = n;
+  }
+
+  bool ok = true;
+  for (auto& b : documented) {
+    auto it = series.find(b.op);
+    if (it == series.end() || it->second.size() < 2)
+      continue;
+    double e = fit_exponent(it->second);
+    bool pass = e <= bound[b.op] + slack;
+    ok = ok && pass;
+    std::cout << "fit " << b.op << " " << e << " " << bound[b.op] << " "
+              << (pass ? "ok" : "FAIL") << std::endl;
+  }
+  return ok ? 0 : 1;
+}
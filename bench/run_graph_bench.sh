@@ -0,0 +1,163 @@
+#!/usr/bin/env bash
+#
+# Benchmark every Graph implementation in hw0/, hw1/ and hw2/ on the
+# workload of graph_bench.cpp and print them ranked.
+#
+# Usage: bench/run_graph_bench.sh [SIDE] [GRAPH_HEADER...]
+#
+#   SIDE            lattice side of the workload (default 30, i.e. 27000
+#                   nodes and about 100000 edges)
+#   GRAPH_HEADER    headers to benchmark (default hw*/Graph_*.hpp)
+#
+# Environment:
+#   CME212_INCLUDE  directory holding CME212/Point.hpp and CME212/Util.hpp
+#                   (required)
+#   CXX, CXXFLAGS   compiler and flags (default g++, -std=c++17 -O2)
+#   JOBS            parallel compiles (default nproc)
+#   TIMEOUT         seconds per benchmark run (default 120)
+#   OUT             output directory (default bench_out)
+#   BASELINE        results.tsv of an earlier run; ops of a variant that got
+#                   more than 25% slower are listed and the exit status is 1
+#
+# Variants are compiled as Graph, Graph<int> or Graph<int,int>, whichever
+# compiles first. Variants run one at a time so their timings do not
+# interfere. Each one's status is ok, compile (does not compile), crash,
+# timeout or wrong (node or edge counts differ from the mesh); only ok
+# variants are ranked.
+#
+# The score is the geometric mean, over every operation that some variant
+# provides, of a variant's time per call divided by the best time per call
+# of any variant, so 1.00 means fastest at everything. An operation a
+# variant does not provide counts as twice the slowest time of any variant,
+# so every score covers the same operations and leaving one out costs more
+# than providing the slowest version of it.
+# Output: OUT/results.tsv (variant, op, ns per call) and the ranked table
+# on stdout.
+
+set -u
+cd "$(dirname "$0")/.."
+
+SIDE=${1:-30}
+shift || true
+HEADERS=("$@")
+if [ ${#HEADERS[@]} -eq 0 ]; then
+  HEADERS=(hw0/Graph_*.hpp hw1/Graph_*.hpp hw2/Graph_*.hpp)
+fi
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:-"-std=c++17 -O2"}
+JOBS=${JOBS:-$(nproc)}
+TIMEOUT=${TIMEOUT:-120}
+OUT=${OUT:-bench_out}
+
+if [ -z "${CME212_INCLUDE:-}" ]; then
+  echo "Set CME212_INCLUDE to the directory holding CME212/Point.hpp" >&2
+  exit 2
+fi
+mkdir -p "$OUT/bin" "$OUT/log"
+
+# Compile one header as Graph, Graph<int> or Graph<int,int>
+build() {
+  local h=$1 name
+  name=$(echo "${h%.hpp}" | tr / _)
+  for args in "" "<int>" "<int,int>"; do
+    if $CXX $CXXFLAGS -I. -I"$CME212_INCLUDE" -DGRAPH_HEADER="\"$h\"" \
+         -DGRAPH_ARGS="$args" bench/graph_bench.cpp -o "$OUT/bin/$name" \
+         2> "$OUT/log/$name.build"; then
+      return 0
+    fi
+  done
+  rm -f "$OUT/bin/$name"
+}
+export -f build
+export CXX CXXFLAGS CME212_INCLUDE OUT
+printf '%s\n' "${HEADERS[@]}" | xargs -P "$JOBS" -I{} bash -c 'build {}'
+
+: > "$OUT/results.tsv"
+: > "$OUT/status.tsv"
+for h in "${HEADERS[@]}"; do
+  name=$(echo "${h%.hpp}" | tr / _)
+  variant=${h%.hpp}
+  if [ ! -x "$OUT/bin/$name" ]; then
+    printf '%s\tcompile\n' "$variant" >> "$OUT/status.tsv"
+    continue
+  fi
+  timeout "$TIMEOUT" "$OUT/bin/$name" "$SIDE" > "$OUT/log/$name.run" 2>&1
+  rc=$?
+  if [ $rc -eq 124 ]; then
+    status=timeout
+  elif [ $rc -ne 0 ]; then
+    status=crash
+  elif awk '$1 == "check" && $3 != $4 { bad = 1 } END { exit !bad }' "$OUT/log/$name.run"; then
+    status=wrong
+  else
+    status=ok
+  fi
+  printf '%s\t%s\n' "$variant" "$status" >> "$OUT/status.tsv"
+  if [ $status = ok ]; then
+    awk -v v="$variant" '$1 == "op" { printf "%s\t%s\t%.3f\n", v, $2, 1e9 * $3 / $4 }' \
+        "$OUT/log/$name.run" >> "$OUT/results.tsv"
+  fi
+done
+
+OPS="add_node add_edge has_edge edge_index edge_iter incident_iter node_value edge_value remove_node"
+
+# Ranked table of the ok variants, then the others
+awk -F'\t' -v ops="$OPS" '
+  FNR == 1 { file++ }
+  file == 1 {
+    ns[$1, $2] = $3
+    if (!($2 in best) || $3 < best[$2]) best[$2] = $3
+    if (!($2 in worst) || $3 > worst[$2]) worst[$2] = $3
+    variants[$1] = 1
+    next
+  }
+  file == 2 && $2 != "ok" { failed[++nf] = $1 "\t" $2 }
+  END {
+    n = split(ops, op, " ")
+    for (v in variants) {
+      s = 0; k = 0; nops[v] = 0
+      for (i = 1; i <= n; ++i) {
+        if (!(op[i] in best))           # no variant provides it
+          continue
+        t = 2 * worst[op[i]]
+        if ((v, op[i]) in ns) {
+          t = ns[v, op[i]]; ++nops[v]
+        }
+        r = best[op[i]] > 0 ? t / best[op[i]] : 1
+        s += log(r > 0 ? r : 1); ++k
+      }
+      score[v] = k ? exp(s / k) : 0
+    }
+    printf "%-4s %-28s %4s %7s", "rank", "variant (ns per call)", "ops", "score"
+    for (i = 1; i <= n; ++i) printf " %13s", op[i]
+    printf "\n"
+    m = 0
+    for (v in variants) order[++m] = v
+    for (i = 2; i <= m; ++i)            # insertion sort by score
+      for (j = i; j > 1 && score[order[j]] < score[order[j-1]]; --j) {
+        t = order[j]; order[j] = order[j-1]; order[j-1] = t
+      }
+    for (r = 1; r <= m; ++r) {
+      v = order[r]
+      printf "%-4d %-28s %4d %7.2f", r, v, nops[v], score[v]
+      for (i = 1; i <= n; ++i)
+        if ((v, op[i]) in ns) printf " %13.1f", ns[v, op[i]]
+        else printf " %13s", "-"
+      printf "\n"
+    }
+    for (i = 1; i <= nf; ++i) {
+      split(failed[i], f, "\t")
+      printf "%-4s %-28s %s\n", "-", f[1], f[2]
+    }
+  }' "$OUT/results.tsv" "$OUT/status.tsv"
+
+# Regressions against a baseline run
+if [ -n "${BASELINE:-}" ]; then
+  awk -F'\t' '
+    FNR == NR { base[$1, $2] = $3; next }
+    ($1, $2) in base && $3 > 1.25 * base[$1, $2] {
+      printf "regression %s %s %.1f -> %.1f ns\n", $1, $2, base[$1, $2], $3
+      bad = 1
+    }
+    END { exit bad }' "$BASELINE" "$OUT/results.tsv" || exit 1
+fi
@@ -0,0 +1,84 @@
+#!/usr/bin/env bash
+#
+# Check the documented complexity of Graph implementations with
+# graph_scaling.cpp and print the fitted growth exponents.
+#
+# Usage: bench/run_graph_scaling.sh [GRAPH_HEADER...]
+#
+#   GRAPH_HEADER    headers to check (default hw*/Graph_*.hpp)
+#
+# Environment:
+#   CME212_INCLUDE  directory holding CME212/Point.hpp and CME212/Util.hpp
+#                   (required)
+#   CXX, CXXFLAGS   compiler and flags (default g++, -std=c++17 -O2)
+#   MAX             largest mesh in nodes (default 1e7)
+#   BUDGET          seconds a variant may spend on one mesh size (default 60)
+#   SLACK           allowed excess over a bound's exponent (default 0.3)
+#   BOUNDS          tighter bounds for every variant, e.g. "has_edge=0"
+#   OUT             output directory (default bench_out)
+#
+# Each row gives the exponent of the time per call of every operation, i.e.
+# 0 for O(1) and 1 for O(num_nodes()) on a bounded-degree mesh; a ! marks
+# one above its bound. The exit status is 1 if any variant exceeds a bound.
+# Per-size timings are in OUT/log/*.scaling.
+
+set -u
+cd "$(dirname "$0")/.."
+
+HEADERS=("$@")
+if [ ${#HEADERS[@]} -eq 0 ]; then
+  HEADERS=(hw0/Graph_*.hpp hw1/Graph_*.hpp hw2/Graph_*.hpp)
+fi
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:-"-std=c++17 -O2"}
+OUT=${OUT:-bench_out}
+
+if [ -z "${CME212_INCLUDE:-}" ]; then
+  echo "Set CME212_INCLUDE to the directory holding CME212/Point.hpp" >&2
+  exit 2
+fi
+mkdir -p "$OUT/bin" "$OUT/log"
+
+ARGS=(--max "${MAX:-1e7}" --budget "${BUDGET:-60}" --slack "${SLACK:-0.3}")
+for b in ${BOUNDS:-}; do
+  ARGS+=(--bound "$b")
+done
+
+OPS="add_node node add_edge has_edge edge edge_iter incident_iter remove_node"
+printf '%-28s' "variant (exponent)"
+for op in $OPS; do printf ' %13s' "$op"; done
+printf '\n'
+
+failed=0
+for h in "${HEADERS[@]}"; do
+  name=$(echo "${h%.hpp}" | tr / _).scaling
+  variant=${h%.hpp}
+  built=
+  for args in "" "<int>" "<int,int>"; do
+    if $CXX $CXXFLAGS -I. -I"$CME212_INCLUDE" -DGRAPH_HEADER="\"$h\"" \
+         -DGRAPH_ARGS="$args" bench/graph_scaling.cpp -o "$OUT/bin/$name" \
+         2> "$OUT/log/$name.build"; then
+      built=1
+      break
+    fi
+  done
+  if [ -z "$built" ]; then
+    printf '%-28s compile\n' "$variant"
+    continue
+  fi
+  "$OUT/bin/$name" "${ARGS[@]}" > "$OUT/log/$name" 2>&1
+  rc=$?
+  [ $rc -ne 0 ] && failed=1
+  awk -v v="$variant" -v ops="$OPS" -v rc=$rc '
+    $1 == "fit" { e[$2] = sprintf("%.2f%s", $3, $5 == "ok" ? "" : "!") }
+    $1 == "stop" { stop = $2 }
+    END {
+      printf "%-28s", v
+      n = split(ops, op, " ")
+      for (i = 1; i <= n; ++i) printf " %13s", (op[i] in e) ? e[op[i]] : "-"
+      if (rc > 1) printf "  crash"
+      if (stop) printf "  (stopped before %d nodes)", stop
+      printf "\n"
+    }' "$OUT/log/$name"
+done
+exit $failed
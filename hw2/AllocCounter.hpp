@@ -0,0 +1,115 @@
+#ifndef CME212_ALLOCCOUNTER_HPP
+#define CME212_ALLOCCOUNTER_HPP
+
+/** @file AllocCounter.hpp
+ * @brief Optional counting of heap allocations, per thread
+ *
+ * Compiling the program with -DCME212_COUNT_ALLOCATIONS replaces the global
+ * operator new and operator delete with versions that count calls and
+ * bytes in thread-local counters before going to malloc and free. The
+ * replacements are defined here, so with the macro set this header must be
+ * included by exactly one translation unit, the one holding main() (as the
+ * single-file drivers are). Without the macro nothing is replaced and
+ * AllocationScope counts nothing.
+ *
+ *   AllocationScope scope;
+ *   graph.add_edge(a, b);
+ *   scope.count().allocations   // heap allocations made by add_edge
+ *
+ * Only the unaligned forms of new are counted; the graph's containers use
+ * nothing else.
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+
+/** Heap activity of one thread. */
+struct AllocationCount {
+  std::uint64_t allocations = 0;   //< calls to operator new
+  std::uint64_t frees = 0;         //< calls to operator delete
+  std::uint64_t bytes = 0;         //< bytes requested from operator new
+};
+
+namespace alloc_counter {
+// Constant-initialized, so operator new can use it at any time
+inline thread_local AllocationCount counts;
+}
+
+/** @class AllocationScope
+ * @brief Counts the allocations of the calling thread from its
+ * construction on.
+ */
+class AllocationScope {
+ public:
+  AllocationScope() : start_(alloc_counter::counts) {}
+
+  /** Whether the program counts allocations at all. */
+  static constexpr bool enabled() {
+#ifdef CME212_COUNT_ALLOCATIONS
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /** The allocations of this thread since construction or restart(). */
+  AllocationCount count() const {
+    const AllocationCount& now = alloc_counter::counts;
+    AllocationCount c;
+    c.allocations = now.allocations - start_.allocations;
+    c.frees = now.frees - start_.frees;
+    c.bytes = now.bytes - start_.bytes;
+    return c;
+  }
+
+  /** Count from now on. */
+  void restart() {
+    start_ = alloc_counter::counts;
+  }
+
+ private:
+  AllocationCount start_;
+};
+
+#ifdef CME212_COUNT_ALLOCATIONS
+void* operator new(std::size_t n) {
+  AllocationCount& c = alloc_counter::counts;
+  ++c.allocations;
+  c.bytes += n;
+  void* p = std::malloc(n ? n : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+void* operator new[](std::size_t n) {
+  return operator new(n);
+}
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept {
+  AllocationCount& c = alloc_counter::counts;
+  ++c.allocations;
+  c.bytes += n;
+  return std::malloc(n ? n : 1);
+}
+void* operator new[](std::size_t n, const std::nothrow_t& t) noexcept {
+  return operator new(n, t);
+}
+// Not inlined, so the compiler does not pair new expressions with free()
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+  if (p)
+    ++alloc_counter::counts.frees;
+  std::free(p);
+}
+void operator delete[](void* p) noexcept {
+  operator delete(p);
+}
+void operator delete(void* p, std::size_t) noexcept {
+  operator delete(p);
+}
+void operator delete[](void* p, std::size_t) noexcept {
+  operator delete(p);
+}
+#endif
+
+#endif // CME212_ALLOCCOUNTER_HPP
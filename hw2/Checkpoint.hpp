@@ -0,0 +1,207 @@
+#ifndef CME212_CHECKPOINT_HPP
+#define CME212_CHECKPOINT_HPP
+
+/** @file Checkpoint.hpp
+ * @brief Periodic checkpoints of the simulation state, written in the
+ * background, and restart from them
+ *
+ * File layout (host byte order):
+ *
+ *   header    CheckpointHeader: "CMECKPT" '\0', uint32 version,
+ *             uint32 reserved, CheckpointState, uint64 graph size
+ *   graph     the graph in the binary graph format of Graph::write_binary(),
+ *             starting at an 8-byte aligned offset
+ *
+ * The graph section holds the topology including removed nodes and edges,
+ * the positions and the node and edge values, so together with the time
+ * and the integrator settings in CheckpointState it is everything a step
+ * depends on. Restarting from a checkpoint and stepping on gives bit for
+ * bit the same states as the run that wrote it.
+ */
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "MeshIO.hpp"
+
+
+/** Simulation state that is not stored in the graph. */
+struct CheckpointState {
+  double t = 0;                 //< simulation time
+  double dt = 0;                //< time step
+  std::int64_t step = 0;        //< steps taken to reach t
+  char solver[16] = {};         //< solver name, as given to --solver
+  std::uint32_t iterations = 0; //< PBD constraint sweeps per step
+  std::uint32_t reserved = 0;
+  double omega = 0;             //< PBD Jacobi over-relaxation factor
+  double damping = 0;           //< damping constant, fixed at the start
+};
+
+struct CheckpointHeader {
+  char magic[8];                //< "CMECKPT"
+  std::uint32_t version;
+  std::uint32_t reserved;
+  CheckpointState state;
+  std::uint64_t graph_bytes;    //< size of the graph section
+};
+static_assert(sizeof(CheckpointHeader) % 8 == 0,
+              "the graph section must start 8-byte aligned");
+
+
+/** @class Checkpointer
+ * @brief Writes checkpoints to one file without stalling the simulation.
+ *
+ * save() serializes the graph into memory, which costs about as much as
+ * one simulation step, and returns; a dedicated thread writes the buffer
+ * to a temporary file and renames it over the checkpoint file, so the file
+ * always holds a complete checkpoint even if the run dies while writing.
+ * If a checkpoint is saved while the previous one is still waiting to be
+ * written, the older one is dropped; dropped() counts how often.
+ */
+class Checkpointer {
+ public:
+  static constexpr std::uint32_t version = 2;
+
+  /** Write checkpoints to @a path. */
+  explicit Checkpointer(const std::string& path)
+      : path_(path), io_([this]() { run(); }) {
+  }
+
+  /** Writes the last saved checkpoint and stops the I/O thread. */
+  ~Checkpointer() {
+    close();
+  }
+
+  Checkpointer(const Checkpointer&) = delete;
+  Checkpointer& operator=(const Checkpointer&) = delete;
+
+  /** Queue a checkpoint of graph @a g in state @a s. */
+  template <typename G>
+  void save(const G& g, const CheckpointState& s) {
+    fill_.resize(sizeof(CheckpointHeader));
+    g.write_binary([this](const void* p, std::size_t bytes) {
+      const char* c = static_cast<const char*>(p);
+      fill_.insert(fill_.end(), c, c + bytes);
+    });
+    CheckpointHeader h{};
+    std::memcpy(h.magic, "CMECKPT", 8);
+    h.version = version;
+    h.state = s;
+    h.graph_bytes = fill_.size() - sizeof(h);
+    std::memcpy(fill_.data(), &h, sizeof(h));
+    {
+      std::lock_guard<std::mutex> lock(m_);
+      if (queued_)
+        ++dropped_;
+      fill_.swap(queued_buf_);
+      queued_ = true;
+    }
+    cv_.notify_one();
+  }
+
+  /** Write the queued checkpoint, if any, and stop the I/O thread. */
+  void close() {
+    if (!io_.joinable())
+      return;
+    {
+      std::lock_guard<std::mutex> lock(m_);
+      closing_ = true;
+    }
+    cv_.notify_one();
+    io_.join();
+  }
+
+  /** Number of checkpoints written to disk. */
+  std::size_t written() const { return written_; }
+  /** Number of checkpoints replaced before they were written. */
+  std::size_t dropped() const { return dropped_; }
+  /** Number of checkpoints that could not be written. */
+  std::size_t failed() const { return failed_; }
+
+ private:
+  // I/O thread: write the latest queued checkpoint until closed and drained
+  void run() {
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(m_);
+        cv_.wait(lock, [this]() { return queued_ || closing_; });
+        if (!queued_)
+          return;
+        write_buf_.swap(queued_buf_);
+        queued_ = false;
+      }
+      if (write(write_buf_))
+        ++written_;
+      else
+        ++failed_;
+    }
+  }
+
+  // Write @a buf to a temporary file, sync it and move it into place
+  bool write(const std::vector<char>& buf) {
+    std::string tmp = path_ + ".tmp";
+    std::FILE* f = std::fopen(tmp.c_str(), "wb");
+    if (!f)
+      return false;
+    bool ok = std::fwrite(buf.data(), 1, buf.size(), f) == buf.size()
+           && std::fflush(f) == 0 && ::fsync(::fileno(f)) == 0;
+    ok = std::fclose(f) == 0 && ok;
+    return ok && std::rename(tmp.c_str(), path_.c_str()) == 0;
+  }
+
+  std::string path_;
+
+  // Producer side: buffer being serialized into
+  std::vector<char> fill_;
+
+  // Shared: the checkpoint waiting to be written
+  std::vector<char> queued_buf_;
+  bool queued_ = false;
+  bool closing_ = false;
+  std::size_t dropped_ = 0;
+  std::mutex m_;
+  std::condition_variable cv_;
+
+  // I/O side
+  std::vector<char> write_buf_;
+  std::size_t written_ = 0;
+  std::size_t failed_ = 0;
+
+  std::thread io_;   // started last, once the members above exist
+};
+
+
+/** Replace graph @a g and state @a s with the checkpoint stored at @a path.
+ *
+ * The graph's arrays are bulk-loaded from the mapped file by
+ * Graph::load_binary(). Throws std::runtime_error if the file cannot be
+ * read or does not hold a compatible checkpoint; @a g and @a s are then
+ * unchanged.
+ *
+ * Complexity: O(g.num_nodes() + g.num_edges()).
+ */
+template <typename G>
+void load_checkpoint(G& g, CheckpointState& s, const std::string& path) {
+  MappedFile file(path);
+  CheckpointHeader h;
+  if (file.size() < sizeof(h))
+    throw std::runtime_error(path + " is not a checkpoint");
+  std::memcpy(&h, file.data(), sizeof(h));
+  if (std::memcmp(h.magic, "CMECKPT", 8) != 0 || h.version != Checkpointer::version ||
+      file.size() - sizeof(h) < h.graph_bytes)
+    throw std::runtime_error(path + " is not a compatible checkpoint");
+  if (!g.load_binary(file.data() + sizeof(h), h.graph_bytes))
+    throw std::runtime_error(path + " holds an incompatible graph");
+  s = h.state;
+}
+
+#endif // CME212_CHECKPOINT_HPP
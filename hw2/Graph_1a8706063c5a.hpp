@@ -8,16 +8,40 @@
 #include <algorithm>
 #include <vector>
 #include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "CME212/Util.hpp"
 #include "CME212/Point.hpp"
 
+#include "SlotMap.hpp"
+
 
 /** @class Graph
  * @brief A template for 3D undirected graphs.
  *
  * Users can add and retrieve nodes and edges. Edges are unique (there is at
  * most one edge between any pair of distinct nodes).
+ *
+ * Removing a node or edge only marks it removed: indices of the others do
+ * not change, and iterators, size() and num_edges() skip it from then on.
+ * Once the removed fraction of the nodes or of the edges passes
+ * compaction_threshold(), the next removal compacts the graph: the live
+ * nodes and edges are renumbered densely in their old order and the
+ * callback given to on_compact() is told the new indices. Between
+ * compactions, indices lie in [0, node_index_end()) and
+ * [0, edge_index_end()) rather than [0, size()) and [0, num_edges()).
  */
 
 template <typename V, typename E>
@@ -68,6 +92,21 @@ class Graph {
 
   using adj_type = std::vector<std::vector<size_type>>;
 
+  /** Stable names of nodes and edges.
+   *
+   * Unlike indices, a handle keeps naming the same node or edge for its
+   * whole life and never names another one after it is removed, so data
+   * outside the graph can be keyed on handles across removals. Validity
+   * checks and lookups by handle are O(1). */
+  using node_handle = typename SlotMap<size_type, Node>::Handle;
+  using edge_handle = typename SlotMap<size_type, Edge>::Handle;
+
+  /** Index of a removed node or edge in the maps passed to on_compact(). */
+  static constexpr size_type removed = size_type(-1);
+
+  /** Old index -> new index of every node or edge, passed to on_compact(). */
+  using remap_type = std::vector<size_type>;
+
  private:
 
   // HW0: YOUR CODE HERE
@@ -82,7 +121,7 @@ class Graph {
 
  struct node_items
  {
-     node_items(Point pos, node_value_type nval): position(pos),NodeVal(nval){};
+     node_items(Point pos, node_value_type nval): position(pos),NodeVal(nval),Active(1){};
 
      Point position;
      node_value_type NodeVal;
@@ -95,28 +134,57 @@ class Graph {
  {
      size_type NodeId1;
      size_type NodeId2;
-     edge_value_type EdgeVal;
      int Active = 1;
+     // Positions of the edge in EAdjList[NodeId1] and EAdjList[NodeId2]
+     size_type Pos1 = 0;
+     size_type Pos2 = 0;
 
-     edge_items(size_type id1,size_type id2, edge_value_type eval)
+     edge_items(size_type id1,size_type id2)
 
      {
           NodeId1=id1;
           NodeId2=id2;
-          EdgeVal=eval;
      }
  };
 
-    using eadj_type = std::vector<std::vector<edge_items>>;
+ // One direction of an edge in a node's adjacency list: the neighbour and
+ // the index of the edge in Edges and EdgeValues
+ struct adj_items
+ {
+     size_type NodeId2;
+     size_type EdgeId;
+     int Active = 1;
+
+     adj_items(size_type id2, size_type eid) : NodeId2(id2), EdgeId(eid) {}
+ };
+
+    using eadj_type = std::vector<std::vector<adj_items>>;
 
     std::vector<std::vector<size_type>> AdjList;
-    std::vector<std::vector<edge_items>> EAdjList;
+    std::vector<std::vector<adj_items>> EAdjList;
 
     std::vector<edge_items> Edges;
 
+    // The value of edge i, stored once for both of its directions
+    std::vector<edge_value_type> EdgeValues;
+
+    // Handle -> index of the live nodes and edges, and index -> handle of
+    // all of them, removed ones included
+    SlotMap<size_type, Node> NodeSlots;
+    SlotMap<size_type, Edge> EdgeSlots;
+    std::vector<node_handle> NodeHandles;
+    std::vector<edge_handle> EdgeHandles;
+
     size_type removednodes=0;
     size_type removededges=0;
 
+    // Bumped by every change to the set of nodes or edges
+    size_type TopologyVersion=0;
+
+    // Removed fraction of the nodes or edges that triggers compact()
+    double CompactionThreshold=0.25;
+    std::function<void(const remap_type&, const remap_type&)> OnCompact;
+
  public:
 
   //
@@ -132,6 +200,105 @@ class Graph {
   /** Default destructor */
   ~Graph() = default;
 
+  //
+  // NEIGHBOURS
+  //
+
+  /** One neighbour of a node, as visited by Node::neighbors(): the node at
+   * the other end of one of its edges and the value of that edge, read
+   * straight from the graph's arrays. @a EdgeValue is edge_value_type, or
+   * const edge_value_type when visited through a const Node. */
+  template <typename EdgeValue>
+  struct basic_neighbor
+  {
+      size_type index;            // index of the neighbour
+      const Point& position;      // position of the neighbour
+      EdgeValue& value;           // value of the edge to it
+  };
+  using neighbor_type = basic_neighbor<edge_value_type>;
+  using const_neighbor_type = basic_neighbor<const edge_value_type>;
+
+  /** @class Graph::NeighborIterator
+   * @brief Iterator over the neighbours of one node, in the order of its
+   * adjacency list (the order of its incident iterator). A forward
+   * iterator yielding basic_neighbor values. */
+  template <typename EdgeValue>
+  class NeighborIterator
+  {
+   public:
+    using value_type        = basic_neighbor<EdgeValue>;
+    using pointer           = void;
+    using reference         = basic_neighbor<EdgeValue>;   // Proxy, by value
+    using difference_type   = std::ptrdiff_t;
+    using iterator_category = std::forward_iterator_tag;
+
+    /** Construct an invalid NeighborIterator. */
+    NeighborIterator() {
+    }
+
+    /** Return the neighbour at this position.
+    * @pre this iterator is != the end of its range
+    *
+    * Complexity: O(1), no Node or Edge objects are built.
+    */
+    reference operator*() const
+    {
+        return reference{Item->NodeId2, GraphPointer->Nodes[Item->NodeId2].position,
+                         GraphPointer->EdgeValues[Item->EdgeId]};
+    }
+
+    NeighborIterator& operator++()
+    {
+        ++Item;
+        return *this;
+    }
+
+    NeighborIterator operator++(int)
+    {
+        NeighborIterator old = *this;
+        ++Item;
+        return old;
+    }
+
+    bool operator==(const NeighborIterator& it) const
+    {
+        return Item == it.Item;
+    }
+
+    bool operator!=(const NeighborIterator& it) const
+    {
+        return Item != it.Item;
+    }
+
+   private:
+    friend class Graph;
+
+    NeighborIterator(const Graph* g, const adj_items* item)
+        : GraphPointer(const_cast<Graph*>(g)), Item(item) {}
+
+    Graph* GraphPointer;
+    const adj_items* Item;    // entry of the node's adjacency list
+  };
+
+  /** The neighbours of one node, as returned by Node::neighbors(). */
+  template <typename EdgeValue>
+  class NeighborRange
+  {
+   public:
+    using iterator = NeighborIterator<EdgeValue>;
+
+    iterator begin() const { return First; }
+    iterator end() const { return Last; }
+    size_type size() const { return size_type(Last.Item - First.Item); }
+
+   private:
+    friend class Graph;
+
+    NeighborRange(iterator first, iterator last) : First(first), Last(last) {}
+
+    iterator First, Last;
+  };
+
   //
   // NODES
   //
@@ -200,6 +367,37 @@ class Graph {
         return IncIterObject;
     }
 
+    /** Returns the neighbours of this node with the values of the edges to
+    * them, in the same order as edge_begin() to edge_end(), e.g.
+    *
+    * @code
+    * for (auto nb : n.neighbors())
+    *   f += nb.value.K * (nb.position - n.position());
+    * @endcode
+    *
+    * Cheaper than the incident iterator when only the neighbour's index
+    * and position and the edge value are needed, since no Node or Edge
+    * objects are built.
+    *
+    * Complexity: No more than O(1)
+    */
+
+    NeighborRange<edge_value_type> neighbors()
+    {
+        auto& adj = GraphPointer->EAdjList[NodeId];
+        using It = NeighborIterator<edge_value_type>;
+        return {It(GraphPointer, adj.data()), It(GraphPointer, adj.data() + adj.size())};
+    }
+
+    /** Returns the neighbours of this node, with read-only edge values. */
+
+    NeighborRange<const edge_value_type> neighbors() const
+    {
+        auto& adj = GraphPointer->EAdjList[NodeId];
+        using It = NeighborIterator<const edge_value_type>;
+        return {It(GraphPointer, adj.data()), It(GraphPointer, adj.data() + adj.size())};
+    }
+
 
     /** Return this node's accessible value. */
     node_value_type& value()
@@ -226,12 +424,21 @@ class Graph {
         return GraphPointer->Nodes[NodeId].position;
     }
 
-    /** Return this node's index, a number in the range [0, graph_size). */
+    /** Return this node's index, a number in the range [0, node_index_end()). */
     size_type index() const {
       assert(GraphPointer->Nodes.size()>NodeId);
       return NodeId;
     }
 
+    /** Return this node's handle, which stays valid until it is removed.
+     *
+     * Complexity: O(1).
+     */
+    node_handle handle() const
+    {
+        return GraphPointer->NodeHandles[NodeId];
+    }
+
     // HW1: YOUR CODE HERE
     // Supply definitions AND SPECIFICATIONS for:
     // node_value_type& value();
@@ -295,8 +502,7 @@ class Graph {
    */
   size_type size() const 
   {
-      return Nodes.size();
-      //return Nodes.size()-removednodes;
+      return Nodes.size()-removednodes;
   }
 
   /** Synonym for size(). */
@@ -305,10 +511,20 @@ class Graph {
       return size();
   }
 
+  /** Return one past the largest node index, removed nodes included.
+   * Equals size() right after a compaction.
+   *
+   * Complexity: O(1).
+   */
+  size_type node_index_end() const
+  {
+      return Nodes.size();
+  }
+
   /** Add a node to the graph, returning the added node.
    * @param[in] position The new node's position
    * @post new num_nodes() == old num_nodes() + 1
-   * @post result_node.index() == old num_nodes()
+   * @post result_node.index() == old node_index_end()
    *
    * Complexity: O(1) amortized operations.
    */
@@ -322,79 +538,273 @@ class Graph {
 
       node_items node_data(position,node_value);
       Nodes.push_back(node_data);
+      ++TopologyVersion;
 
       std::vector<size_type> v;
       AdjList.push_back(v);
 
-      std::vector<edge_items> ev;
+      std::vector<adj_items> ev;
       EAdjList.push_back(ev);
 
-      Node NodeObject(this, size()-1);
+      NodeHandles.push_back(NodeSlots.insert(Nodes.size()-1));
+
+      Node NodeObject(this, Nodes.size()-1);
       return NodeObject;
 
   }
 
 /** Removes a node from the graph, returning a size_type indicating removal.
-     * Invalidates a node with id ==@a n.NodeId by turning activity to 0.
+     * Marks the node with id ==@a n.NodeId and its edges removed.
    * @param[in] @a n, the node to be removed
    * @post new num_nodes() == old num_nodes() -1
    * @post has_node(@a n) == false
+   * @post has_node(@a n.handle()) == false, and the handles of its edges
+   *       are invalid too
    * @return @a size_type i, indicating that node was removed
    *
-   * Complexity: O(num_nodes) amortized operations.
+   * Invalidates node and edge indices if it triggers a compaction.
+   *
+   * Complexity: O(degree of @a n), plus O(num_nodes() + num_edges()) when
+   * it compacts.
    */
 
   size_type remove_node(const Node& n)
   {
-      (void) n;
-
       assert(has_node(n));
-
-      size_type index = n.NodeId;
-      Nodes[index].Active=0;
-      assert(Nodes[index].Active==0);
-
-      for (size_type i =0; i <Edges.size();++i)
-      {
-          if(Edges[i].NodeId1==0 or Edges[i].NodeId2==0)
-          {
-                Edges[i].Active=0;
-          }
-     }
-
-     for (size_type i=0;i<EAdjList[index].size();++i)
-     {
-         EAdjList[index][i].Active=0;
-         size_type oid = EAdjList[index][i].NodeId2;
-
-         for (size_type j=0;j<EAdjList[oid].size();++j)
-         {
-             EAdjList[oid][j].Active=0;
-         }
-     }
-    removednodes++;
-    return 1;
-
+      kill_node(n.NodeId);
+      ++TopologyVersion;
+      compact_if_fragmented();
+      return 1;
   }
 
-/** Removes a node from the graph, returning a size_type indicating removal.
-     * Invalidates a node with id ==@a n.NodeId by turning activity to 0.
+/** Removes a node from the graph, returning an iterator to the next node.
+     * Marks the node with id ==@a (*nit).NodeId and its edges removed.
      * @pre nit != node_end()
    * @param[in] @a nit, the pointer to node to be removed
    * @post new num_nodes() == old num_nodes() -1
    * @post has_node(@a *nit) == false
-   * @return @a size_type i, indicating that node was removed
+   * @return @a nit, which now points at the node that took the removed
+   *         node's place in the iteration order (the last one), so a sweep
+   *         over the nodes can go on from it; node_end() if there is none
    *
-   * Complexity: O(n) amortized operations.
+   * Complexity: as remove_node(const Node&).
    */
     node_iterator remove_node(node_iterator nit)
     {
         assert(nit != node_end());
         remove_node(*nit);
-        removednodes++;
         return nit;
     }
 
+  /** Return the removed fraction of nodes or edges above which removals
+   * compact the graph. */
+  double compaction_threshold() const
+  {
+      return CompactionThreshold;
+  }
+
+  /** Compact the graph once more than the fraction @a f of its nodes or
+   * of its edges is removed. 0 compacts on every removal, 1 or more never
+   * does; compact() can still be called directly. Default 0.25.
+   */
+  void set_compaction_threshold(double f)
+  {
+      CompactionThreshold = f;
+  }
+
+  /** Call @a fn(node_map, edge_map) after every compaction. The maps give
+   * the new index of each node and edge by old index, or removed, so data
+   * kept outside the graph by index can follow (see remap()). Replaces
+   * any earlier callback.
+   */
+  void on_compact(std::function<void(const remap_type&, const remap_type&)> fn)
+  {
+      OnCompact = std::move(fn);
+  }
+
+  /** Drop the removed nodes and edges and renumber the others densely,
+   * keeping their order.
+   * @post node_index_end() == num_nodes() && edge_index_end() == num_edges()
+   *
+   * Invalidates node and edge indices, Node and Edge objects and
+   * iterators, but not handles. Calls the on_compact() callback.
+   *
+   * Complexity: O(node_index_end() + edge_index_end()).
+   */
+  void compact()
+  {
+      remap_type node_map(Nodes.size(), removed);
+      remap_type edge_map(Edges.size(), removed);
+
+      size_type n = 0;
+      for (size_type i = 0; i < Nodes.size(); ++i)
+      {
+          if (!Nodes[i].Active)
+              continue;
+          if (n != i)
+          {
+              Nodes[n] = std::move(Nodes[i]);
+              Points[n] = std::move(Points[i]);
+              AdjList[n] = std::move(AdjList[i]);
+              EAdjList[n] = std::move(EAdjList[i]);
+              NodeHandles[n] = NodeHandles[i];
+          }
+          NodeSlots[NodeHandles[n]] = n;
+          node_map[i] = n++;
+      }
+      Nodes.erase(Nodes.begin() + n, Nodes.end());
+      Points.erase(Points.begin() + n, Points.end());
+      AdjList.erase(AdjList.begin() + n, AdjList.end());
+      EAdjList.erase(EAdjList.begin() + n, EAdjList.end());
+      NodeHandles.erase(NodeHandles.begin() + n, NodeHandles.end());
+
+      size_type m = 0;
+      for (size_type k = 0; k < Edges.size(); ++k)
+      {
+          if (!Edges[k].Active)
+              continue;
+          if (m != k)
+          {
+              Edges[m] = Edges[k];
+              EdgeValues[m] = std::move(EdgeValues[k]);
+              EdgeHandles[m] = EdgeHandles[k];
+          }
+          Edges[m].NodeId1 = node_map[Edges[m].NodeId1];
+          Edges[m].NodeId2 = node_map[Edges[m].NodeId2];
+          EdgeSlots[EdgeHandles[m]] = m;
+          edge_map[k] = m++;
+      }
+      Edges.erase(Edges.begin() + m, Edges.end());
+      EdgeValues.erase(EdgeValues.begin() + m, EdgeValues.end());
+      EdgeHandles.erase(EdgeHandles.begin() + m, EdgeHandles.end());
+
+      // Adjacency lists only hold live edges, so every entry maps
+      for (size_type i = 0; i < n; ++i)
+      {
+          for (auto& j : AdjList[i])
+              j = node_map[j];
+          for (auto& item : EAdjList[i])
+          {
+              item.NodeId2 = node_map[item.NodeId2];
+              item.EdgeId = edge_map[item.EdgeId];
+          }
+      }
+
+      removednodes = 0;
+      removededges = 0;
+      ++TopologyVersion;
+      if (OnCompact)
+          OnCompact(node_map, edge_map);
+  }
+
+  /** Move the entries of @a v, indexed by node or edge index, to the
+   * indices given by @a map, a map passed to on_compact(), and drop those
+   * of removed nodes or edges.
+   *
+   * Complexity: O(@a map.size()).
+   */
+  template <typename T>
+  static void remap(std::vector<T>& v, const remap_type& map)
+  {
+      // Compaction keeps the order, so map[i] <= i and one forward pass
+      // never overwrites an entry it still needs
+      std::size_t n = 0;
+      for (std::size_t i = 0; i < map.size() && i < v.size(); ++i)
+      {
+          if (map[i] == removed)
+              continue;
+          if (map[i] != i)
+              v[map[i]] = std::move(v[i]);
+          n = map[i] + 1;
+      }
+      v.resize(n);
+  }
+
+  /** Reserve storage for @a nodes nodes and @a edges edges in total.
+   * @post Adding nodes and edges up to those counts does not reallocate
+   *       the graph's node and edge arrays.
+   *
+   * Complexity: O(@a nodes + @a edges).
+   */
+  void reserve(size_type nodes, size_type edges)
+  {
+      Points.reserve(nodes);
+      Nodes.reserve(nodes);
+      AdjList.reserve(nodes);
+      EAdjList.reserve(nodes);
+      Edges.reserve(edges);
+      EdgeValues.reserve(edges);
+      NodeSlots.reserve(nodes);
+      EdgeSlots.reserve(edges);
+      NodeHandles.reserve(nodes);
+      EdgeHandles.reserve(edges);
+  }
+
+  /** Bytes held by a graph, by what they store. */
+  struct MemoryUsage
+  {
+      std::size_t nodes = 0;        // positions, node values and flags, in
+                                    // Nodes and its Points copy
+      std::size_t adjacency = 0;    // AdjList and EAdjList entries and
+                                    // their headers
+      std::size_t edge_values = 0;  // EdgeValues
+      std::size_t index_maps = 0;   // edge index -> node pair (Edges),
+                                    // handles <-> indices
+      std::size_t slack = 0;        // reserved but unused capacity of all
+                                    // of the above
+
+      std::size_t total() const
+      {
+          return nodes + adjacency + edge_values + index_maps + slack;
+      }
+  };
+
+  /** Return the heap memory held by this graph, broken down by use.
+   * Counts the elements and capacity of the graph's vectors, not the
+   * allocator's own overhead per block, nor anything a node or edge value
+   * holds on the heap itself.
+   *
+   * Complexity: O(num_nodes()).
+   */
+  MemoryUsage memory_usage() const
+  {
+      MemoryUsage m;
+      auto slack = [&m](const auto& v) {
+          m.slack += (v.capacity() - v.size()) * sizeof(v[0]);
+      };
+
+      m.nodes = Nodes.size() * sizeof(node_items) + Points.size() * sizeof(Points[0]);
+      slack(Nodes);
+      slack(Points);
+
+      for (auto& adj : EAdjList)
+      {
+          m.adjacency += adj.size() * sizeof(adj_items);
+          slack(adj);
+      }
+      for (auto& adj : AdjList)
+      {
+          m.adjacency += adj.size() * sizeof(size_type);
+          slack(adj);
+      }
+      m.adjacency += AdjList.size() * sizeof(AdjList[0])
+                   + EAdjList.size() * sizeof(EAdjList[0]);
+      slack(AdjList);
+      slack(EAdjList);
+
+      m.edge_values = EdgeValues.size() * sizeof(edge_value_type);
+      m.index_maps = Edges.size() * sizeof(edge_items)
+                   + NodeSlots.bytes() + EdgeSlots.bytes()
+                   + NodeHandles.size() * sizeof(node_handle)
+                   + EdgeHandles.size() * sizeof(edge_handle);
+      slack(EdgeValues);
+      slack(Edges);
+      slack(NodeHandles);
+      slack(EdgeHandles);
+      m.slack += NodeSlots.reserved_bytes() + EdgeSlots.reserved_bytes();
+      return m;
+  }
+
   /** Determine if a Node belongs to this Graph
    * @return True if @a n is currently a Node of this Graph
    *
@@ -403,12 +813,11 @@ class Graph {
 
   bool has_node(const Node& n) const 
   {
-      return (n.GraphPointer==this && n.index() < size());
-      //assert( Nodes[n.index()].Active==1);
+      return (n.GraphPointer==this && n.NodeId < Nodes.size() && Nodes[n.NodeId].Active);
   }
 
   /** Return the node with index @a i.
-   * @pre 0 <= @a i < num_nodes()
+   * @pre 0 <= @a i < node_index_end()
    * @post result_node.index() == i
    *
    * Complexity: O(1).
@@ -420,6 +829,27 @@ class Graph {
       return Node(this,i);       
   }
 
+  /** Determine if @a h names a node of this Graph that was not removed.
+   *
+   * Complexity: O(1).
+   */
+  bool has_node(node_handle h) const
+  {
+      return NodeSlots.contains(h);
+  }
+
+  /** Return the node named by @a h.
+   * @pre has_node(@a h)
+   * @post result_node.handle() == @a h
+   *
+   * Complexity: O(1).
+   */
+  Node node(node_handle h) const
+  {
+      assert(has_node(h));
+      return Node(this,NodeSlots[h]);
+  }
+
   //
   // EDGES
   //
@@ -442,6 +872,7 @@ class Graph {
         NodeId1=id1;
         NodeId2=id2;
         GraphPointer=const_cast<Graph*>(currentgraph);
+        EdgeId=GraphPointer->find_edge(id1,id2);
     }
 
     /** Return a node of this Edge */
@@ -456,44 +887,20 @@ class Graph {
       return Node(GraphPointer,NodeId2);   
     }
 
-    /** Return this edge's value */
-   const edge_value_type& value() const
+    /** Return this edge's value.
+     * Both directions of an edge share the one value.
+     *
+     * Complexity: O(1).
+     */
+    const edge_value_type& value() const
     {
-        auto chosennodeid=std::min(NodeId1,NodeId2);
-        auto othernodeid=std::max(NodeId1,NodeId2);
-
-        auto ConnectedEdges = GraphPointer->EAdjList[chosennodeid];
-
-        for (int i = 0 ; i < ConnectedEdges.size() ; ++i)
-        {
-            size_type node2_uid = GraphPointer->EAdjList[chosennodeid][i].NodeId2;
-            if (node2_uid==othernodeid)
-            {
-               // std::cout << "Returning edgeval" << std::endl;
-                return GraphPointer->EAdjList[chosennodeid][i].EdgeVal;
-            }
-        }
-        assert(0);
+        return GraphPointer->EdgeValues[EdgeId];
     }
 
-    // Return edge's value
+    /** Return this edge's value, for modification. */
     edge_value_type& value()
     {
-        auto chosennodeid=std::min(NodeId1,NodeId2);
-        auto othernodeid=std::max(NodeId1,NodeId2);
-
-        auto ConnectedEdges = GraphPointer->EAdjList[chosennodeid];
-
-        for (int i = 0 ; i < ConnectedEdges.size() ; ++i)
-        {
-            size_type node2_uid = GraphPointer->EAdjList[chosennodeid][i].NodeId2;
-            if (node2_uid==othernodeid)
-            {
-               // std::cout << "Returning edgeval" << std::endl;
-                return GraphPointer->EAdjList[chosennodeid][i].EdgeVal;
-            }
-        }
-        assert(0);
+        return GraphPointer->EdgeValues[EdgeId];
     }
 
     double length() const
@@ -501,6 +908,16 @@ class Graph {
         return norm(node1().position() - node2().position());
     }
 
+    /** Return this edge's handle, which stays valid until it is removed.
+     * Both directions of an edge have the same handle.
+     *
+     * Complexity: O(1).
+     */
+    edge_handle handle() const
+    {
+        return GraphPointer->EdgeHandles[EdgeId];
+    }
+
     /** Test whether this edge and @a e are equal.
      *
      * Equal edges represent the same undirected edge between two nodes.
@@ -536,9 +953,18 @@ class Graph {
     // that will not be visible to users, but may be useful within Graph.
     // i.e. Graph needs a way to construct valid Edge objects
 
+    Edge(const Graph* currentgraph, size_type id1, size_type id2, size_type eid)
+    {
+        NodeId1=id1;
+        NodeId2=id2;
+        EdgeId=eid;
+        GraphPointer=const_cast<Graph*>(currentgraph);
+    }
+
     Graph* GraphPointer;
     size_type NodeId1;
     size_type NodeId2;
+    size_type EdgeId;   // index into Edges and EdgeValues
   };
 
   /** Return the total number of edges in the graph.
@@ -557,7 +983,7 @@ class Graph {
   */
   void Adjacency(adj_type& AdjList ,size_type NodeId1, size_type NodeId2)
   {
-      assert(NodeId1 < num_nodes() && NodeId2 < num_nodes());
+      assert(NodeId1 < node_index_end() && NodeId2 < node_index_end());
       assert(NodeId1 != NodeId2);
 
       AdjList[NodeId1].push_back(NodeId2);
@@ -566,23 +992,47 @@ class Graph {
 
   }
 
-  void EAdjacency(eadj_type& EAdjList,size_type NodeId1, size_type NodeId2, edge_value_type edge_value)
+  void EAdjacency(eadj_type& EAdjList,size_type NodeId1, size_type NodeId2, size_type EdgeId)
   {
-      edge_items edgeData1(NodeId1,NodeId2,edge_value);
-      edge_items edgeData2(NodeId2,NodeId1,edge_value);
+      adj_items edgeData1(NodeId2,EdgeId);
+      adj_items edgeData2(NodeId1,EdgeId);
 
+      Edges[EdgeId].Pos1 = EAdjList[NodeId1].size();
+      Edges[EdgeId].Pos2 = EAdjList[NodeId2].size();
       EAdjList[NodeId1].push_back(edgeData1);
       EAdjList[NodeId2].push_back(edgeData2);
   }
 
   size_type num_edges() const 
+  {
+    return Edges.size()-removededges;
+  }
+
+  /** Return one past the largest edge index, removed edges included.
+   * Equals num_edges() right after a compaction.
+   *
+   * Complexity: O(1).
+   */
+  size_type edge_index_end() const
   {
     return Edges.size();
-    //return Edges.size()-removededges;
+  }
+
+  /** Return the topology version of the graph.
+   *
+   * The version changes whenever a node or edge is added or removed, and
+   * only then, so callers can cache anything derived from the topology
+   * and rebuild it when the version they saw is no longer current.
+   *
+   * Complexity: O(1).
+   */
+  size_type topology_version() const
+  {
+    return TopologyVersion;
   }
 
   /** Return the edge with index @a i.
-   * @pre 0 <= @a i < num_edges()
+   * @pre 0 <= @a i < edge_index_end()
    *
    * Complexity: No more than O(num_nodes() + num_edges()), hopefully less
    */
@@ -590,24 +1040,45 @@ class Graph {
   {
 
     assert(Edges.size()>i); //Asseting that i < number of edges
-    Edge EdgeObject(this,Edges[i].NodeId1,Edges[i].NodeId2);
+    Edge EdgeObject(this,Edges[i].NodeId1,Edges[i].NodeId2,i);
     return EdgeObject;    
 
   }
 
+  /** Determine if @a h names an edge of this Graph that was not removed.
+   *
+   * Complexity: O(1).
+   */
+  bool has_edge(edge_handle h) const
+  {
+      return EdgeSlots.contains(h);
+  }
+
+  /** Return the edge named by @a h.
+   * @pre has_edge(@a h)
+   * @post result_edge.handle() == @a h
+   *
+   * Complexity: O(1).
+   */
+  Edge edge(edge_handle h) const
+  {
+      assert(has_edge(h));
+      return edge(EdgeSlots[h]);
+  }
+
   /** Test whether two nodes are connected by an edge.
    * @pre @a a and @a b are valid nodes of this graph
    * @return True if for some @a i, edge(@a i) connects @a a and @a b.
    *
-   * Complexity: No more than O(num_nodes() + num_edges()), hopefully less
+   * Complexity: O(degree of @a a), without allocating.
    */
   bool has_edge(const Node& a, const Node& b) const 
   {
 
     assert(a.GraphPointer== this and b.GraphPointer == this); // asserting nodes in graph
-    assert(a.NodeId < size() && b.NodeId < size()); // asserting nodes are valid
+    assert(a.NodeId < Nodes.size() && b.NodeId < Nodes.size()); // asserting nodes are valid
 
-    std::vector<size_type> connected_nodes = AdjList[a.NodeId];
+    const std::vector<size_type>& connected_nodes = AdjList[a.NodeId];
 
     for (size_type ind = 0; ind < connected_nodes.size(); ind++)
     {
@@ -639,111 +1110,138 @@ class Graph {
     
     if (has_edge(a,b))
     {
-        Edge EdgeObject(this,a.NodeId,b.NodeId);
+        Edge EdgeObject(this,a.NodeId,b.NodeId,find_edge(a.NodeId,b.NodeId));
         return EdgeObject;
     }
       assert(a.GraphPointer != nullptr && b.GraphPointer != nullptr);
       assert(a.NodeId != b.NodeId);
 
-    edge_items edgeData(a.NodeId,b.NodeId,edge_value);
+    size_type EdgeId = Edges.size();
+    edge_items edgeData(a.NodeId,b.NodeId);
     Edges.push_back(edgeData);
+    EdgeValues.push_back(edge_value);
+    EdgeHandles.push_back(EdgeSlots.insert(EdgeId));
+    ++TopologyVersion;
 
     Adjacency(AdjList,a.NodeId,b.NodeId); // Adding adjacency list
-    EAdjacency(EAdjList,a.NodeId,b.NodeId,edge_value); // Adding Eadjacency list
+    EAdjacency(EAdjList,a.NodeId,b.NodeId,EdgeId); // Adding Eadjacency list
 
-    Edge EdgeObject(this,a.NodeId,b.NodeId);
+    Edge EdgeObject(this,a.NodeId,b.NodeId,EdgeId);
     return EdgeObject;
     
 
   }
+  /** Add an edge between each pair of node indices in @a pairs, in order,
+   * all with the value @a edge_value.
+   * @pre Each pair names two distinct valid nodes of this graph.
+   * @pre No pair is repeated, in either order, and none is an edge yet.
+   * @post The graph is the one add_edge() on each pair in turn builds.
+   *
+   * Builds the adjacency in bulk, as load_binary() does: the new entries
+   * of every node are counted first, so each list grows once, and no list
+   * is searched for an existing edge.
+   *
+   * Complexity: O(num_nodes() + @a pairs.size()).
+   */
+  template <typename Pair>
+  void add_edges(const std::vector<Pair>& pairs,
+                 const edge_value_type& edge_value = edge_value_type())
+  {
+      // Room for n elements, growing geometrically so that many small
+      // calls stay amortized O(1) per element
+      auto grow = [](auto& v, std::size_t n) {
+          if (v.capacity() < n)
+              v.reserve(std::max(n, 2*v.capacity()));
+      };
+      std::vector<size_type> added(Nodes.size(), 0);
+      for (const Pair& p : pairs)
+      {
+          assert(p[0] < Nodes.size() && p[1] < Nodes.size() && p[0] != p[1]);
+          assert(!has_edge(node(p[0]), node(p[1])));
+          ++added[p[0]];
+          ++added[p[1]];
+      }
+      for (size_type i = 0; i < Nodes.size(); ++i)
+      {
+          if (added[i] == 0)
+              continue;
+          grow(AdjList[i], AdjList[i].size() + added[i]);
+          grow(EAdjList[i], EAdjList[i].size() + added[i]);
+      }
+      grow(Edges, Edges.size() + pairs.size());
+      grow(EdgeValues, EdgeValues.size() + pairs.size());
+      grow(EdgeHandles, EdgeHandles.size() + pairs.size());
+      for (const Pair& p : pairs)
+      {
+          size_type EdgeId = Edges.size();
+          Edges.emplace_back(p[0], p[1]);
+          EdgeValues.push_back(edge_value);
+          EdgeHandles.push_back(EdgeSlots.insert(EdgeId));
+          Adjacency(AdjList, p[0], p[1]);
+          EAdjacency(EAdjList, p[0], p[1], EdgeId);
+      }
+      ++TopologyVersion;
+  }
+
     /** Removes an edge from the graph, returning a size_type indicating removal.
-    * Invalidates a edge with id1 ==@a n1.NodeId and id2==@a n2.NodeId by turning activity to 0.
-    * @pre has_edge(n1,n2) == true
+    * Marks the edge between @a n1 and @a n2 removed.
     * @param[in] @a n1, @a n2, standing for the connected nodes which edges will be removed
-    * @post new num_edges() == old num_edges() -1
+    * @post new num_edges() == old num_edges() -1 if there was such an edge
     * @post has_edge(@a n1,n2) == false
-    * @return @a size_type i, indicating that edge was removed
+    * @return 1 if the edge was removed, 0 if there was none
+    *
+    * Invalidates node and edge indices if it triggers a compaction.
     *
-    * Complexity: O(num_nodes+num_edges) amortized operations.
+    * Complexity: O(degree of @a n1), plus O(num_nodes() + num_edges())
+    * when it compacts.
     */
 
 
   size_type remove_edge(const Node& n1, const Node& n2) {
-      auto chosennodeid = std::min(n1.index(), n2.index());
-      auto othernodeid = std::max(n1.index(), n2.index());
-
-      auto GraphPointer = n1.GraphPointer;
-      auto ConnectedEdges = GraphPointer->EAdjList[chosennodeid];
-
-      for (int i = 0; i < ConnectedEdges.size(); ++i) {
-          size_type node2_uid = GraphPointer->EAdjList[chosennodeid][i].NodeId2;
-          if (node2_uid == othernodeid) {
-              GraphPointer->EAdjList[chosennodeid][i].Active = 0;
-          }
-      }
-
-      auto ConnectedEdges2 = GraphPointer->EAdjList[othernodeid];
-
-      for (int i = 0; i < ConnectedEdges2.size(); ++i)
-      {
-          size_type node2_uid = GraphPointer->EAdjList[othernodeid][i].NodeId2;
-          if (node2_uid == chosennodeid)
-          {
-              GraphPointer->EAdjList[othernodeid][i].Active = 0;
-          }
-      }
-
-      removededges++;
-      for (size_type i = 0; i < Edges.size(); ++i)
-      {
-          size_type minid=std::min(Edges[i].NodeId1,Edges[i].NodeId2);
-          size_type maxid=std::max(Edges[i].NodeId1,Edges[i].NodeId2);
-
-          if(chosennodeid==minid and othernodeid==maxid)
-          {
-              Edges[i].Active = 0;
-
-              return 1;
-          }
-      }
-
-      assert(0);
+      size_type EdgeId = find_edge(n1.index(), n2.index());
+      if (EdgeId == Edges.size())
+          return 0;
+      kill_edge(EdgeId);
+      ++TopologyVersion;
+      compact_if_fragmented();
+      return 1;
   }
 /** Removes an edge from the graph, returning a size_type indicating removal.
-    * Invalidates a edge with id1 ==@a e.NodeId1 and id2==@a e.NodeId2 by turning activity to 0.
+    * Marks the edge between @a e.node1() and @a e.node2() removed.
     * @pre has_edge(n1,n2) == true
     * @param[in] @a e standing for the edge to be removed
     * @post new num_edges() == old num_edges() -1
     * @post has_edge(@a n1,n2) == false
     * @return @a size_type i, indicating that edge was removed
     *
-    * Complexity: O(num_nodes+num_edges) amortized operations.
+    * Complexity: O(1), plus O(num_nodes() + num_edges()) when it compacts.
     */
 
     size_type remove_edge(const Edge& e)
   {
-      Node n1 = e.node1();
-      Node n2 = e.node2();
-      removededges++;
-      return remove_edge(n1,n2);
+      if (!Edges[e.EdgeId].Active)
+          return 0;
+      kill_edge(e.EdgeId);
+      ++TopologyVersion;
+      compact_if_fragmented();
+      return 1;
   }
-/** Removes an edge from the graph, returning a size_type indicating removal.
-    * Invalidates a edge @a *eit by turning activity to 0.
-    * @pre has_edge(n1,n2) == true
+/** Removes an edge from the graph, returning an iterator to the next edge.
+    * Marks the edge @a *eit removed.
+    * @pre @a eit != edge_end()
     * @param[in] @a eit standing for the iterator pointing to edge to be removed
     * @post new num_edges() == old num_edges() -1
     * @post has_edge(@a *eit.Node1(),*eit.Node2()) == false
-    * @return @a size_type i, indicating that edge was removed
+    * @return @a eit, which now points at the edge that took the removed
+    *         edge's place in the iteration order, or edge_end()
     *
-    * Complexity: O(num_nodes+num_edges) amortized operations.
+    * Complexity: as remove_edge(const Edge&).
     */
 
   edge_iterator remove_edge(edge_iterator e_it)
   {
-      auto e1 = *e_it;
-      remove_edge(e1);
-      //++e_it;
-      removededges++;
+      assert(e_it != edge_end());
+      remove_edge(*e_it);
       return e_it;
   }
   /** Remove all nodes and edges from this graph.
@@ -754,8 +1252,360 @@ class Graph {
   void clear() {
     Points.clear();
     Edges.clear();
+    EdgeValues.clear();
+    AdjList.clear();
     EAdjList.clear();
     Nodes.clear();
+    NodeSlots.clear();
+    EdgeSlots.clear();
+    NodeHandles.clear();
+    EdgeHandles.clear();
+    removednodes=0;
+    removededges=0;
+    ++TopologyVersion;
+  }
+
+  //
+  // Binary storage
+  //
+
+  /** Header of the binary graph format written by save_binary().
+   *
+   * The header is followed by these sections, each starting on an 8-byte
+   * boundary, in this order:
+   *   positions     num_nodes x Point
+   *   node_active   num_nodes x uint8
+   *   node_values   num_nodes x V          (if flags & has_node_values)
+   *   adj_offsets   (num_nodes + 1) x uint64, CSR row offsets
+   *   adj_targets   num_adj x uint32, neighbour node index
+   *   adj_edges     num_adj x uint32, index into the edge arrays
+   *   adj_active    num_adj x uint8
+   *   edge_nodes    num_edges x 2 x uint32
+   *   edge_active   num_edges x uint8
+   *   edge_values   num_edges x E          (if flags & has_edge_values)
+   *   node_order    (num_nodes - removed_nodes) x uint32, node indices in
+   *                 iteration order                        (version >= 2)
+   *   edge_order    (num_edges - removed_edges) x uint32, edge indices in
+   *                 iteration order                        (version >= 2)
+   * Node and edge indices are the graph's own, removed entries included,
+   * so a loaded graph has the same indices as the saved one. It also
+   * iterates in the same order, which removals make differ from index
+   * order, so that anything summed over the nodes or edges comes out the
+   * same. Version 1 files iterate in index order. Handles are not stored:
+   * loading gives every node and edge a new one.
+   */
+  struct BinaryHeader {
+    char magic[8];              // "CMEGRAPH"
+    std::uint32_t version;      // binary_version
+    std::uint32_t flags;
+    std::uint64_t num_nodes;
+    std::uint64_t num_edges;
+    std::uint64_t num_adj;
+    std::uint32_t node_value_size;
+    std::uint32_t edge_value_size;
+    std::uint64_t removed_nodes;
+    std::uint64_t removed_edges;
+  };
+  static constexpr std::uint32_t binary_version = 2;
+  static constexpr std::uint32_t has_node_values = 1;
+  static constexpr std::uint32_t has_edge_values = 2;
+
+  /** Write this graph to @a path in the binary graph format.
+   * Node and edge values are stored if their types are trivially copyable.
+   * @return true on success
+   *
+   * Complexity: O(num_nodes() + num_edges()) amortized operations.
+   */
+  bool save_binary(const std::string& path) const
+  {
+      std::FILE* f = std::fopen(path.c_str(), "wb");
+      if (!f)
+          return false;
+      bool ok = true;
+      write_binary([&](const void* p, std::size_t bytes) {
+          if (bytes && std::fwrite(p, 1, bytes, f) != bytes)
+              ok = false;
+      });
+      return std::fclose(f) == 0 && ok;
+  }
+
+  /** Emit this graph in the binary graph format as a sequence of
+   * @a out(const void* data, std::size_t bytes) calls.
+   *
+   * Section alignment is relative to the first byte emitted, so the output
+   * may be embedded in a larger file at any 8-byte aligned offset.
+   *
+   * Complexity: O(num_nodes() + num_edges()) amortized operations.
+   */
+  template <typename Out>
+  void write_binary(Out&& out) const
+  {
+      BinaryHeader h;
+      std::memcpy(h.magic, "CMEGRAPH", 8);
+      h.version = binary_version;
+      h.flags = (std::is_trivially_copyable<node_value_type>::value ? has_node_values : 0)
+              | (std::is_trivially_copyable<edge_value_type>::value ? has_edge_values : 0);
+      h.num_nodes = Nodes.size();
+      h.num_edges = Edges.size();
+      h.num_adj = 0;
+      for (auto& adj : EAdjList)
+          h.num_adj += adj.size();
+      h.node_value_size = sizeof(node_value_type);
+      h.edge_value_size = sizeof(edge_value_type);
+      h.removed_nodes = removednodes;
+      h.removed_edges = removededges;
+
+      std::uint64_t written = 0;
+      auto put = [&](const void* p, std::size_t bytes) {
+          out(p, bytes);
+          written += bytes;
+      };
+      auto section = [&]() {
+          static const char zeros[8] = {};
+          put(zeros, (8 - written % 8) % 8);
+      };
+      put(&h, sizeof(h));
+
+      section();
+      for (auto& n : Nodes)
+          put(&n.position, sizeof(Point));
+      section();
+      for (auto& n : Nodes) {
+          std::uint8_t a = n.Active ? 1 : 0;
+          put(&a, 1);
+      }
+      if (h.flags & has_node_values) {
+          section();
+          for (auto& n : Nodes)
+              put(&n.NodeVal, sizeof(node_value_type));
+      }
+
+      // Adjacency as CSR, each entry pointing at its edge's slot
+      section();
+      std::uint64_t off = 0;
+      put(&off, sizeof(off));
+      for (auto& adj : EAdjList) {
+          off += adj.size();
+          put(&off, sizeof(off));
+      }
+      section();
+      for (auto& adj : EAdjList)
+          for (auto& item : adj) {
+              std::uint32_t j = item.NodeId2;
+              put(&j, sizeof(j));
+          }
+      section();
+      for (auto& adj : EAdjList)
+          for (auto& item : adj) {
+              std::uint32_t k = item.EdgeId;
+              put(&k, sizeof(k));
+          }
+      section();
+      for (auto& adj : EAdjList)
+          for (auto& item : adj) {
+              std::uint8_t a = item.Active ? 1 : 0;
+              put(&a, 1);
+          }
+
+      section();
+      for (auto& e : Edges) {
+          std::uint32_t ids[2] = {e.NodeId1, e.NodeId2};
+          put(ids, sizeof(ids));
+      }
+      section();
+      for (auto& e : Edges) {
+          std::uint8_t a = e.Active ? 1 : 0;
+          put(&a, 1);
+      }
+      if (h.flags & has_edge_values) {
+          section();
+          put(EdgeValues.data(), EdgeValues.size() * sizeof(edge_value_type));
+      }
+
+      section();
+      for (size_type p = 0; p < NodeSlots.size(); ++p) {
+          std::uint32_t i = NodeSlots.value_at(p);
+          put(&i, sizeof(i));
+      }
+      section();
+      for (size_type p = 0; p < EdgeSlots.size(); ++p) {
+          std::uint32_t k = EdgeSlots.value_at(p);
+          put(&k, sizeof(k));
+      }
+  }
+
+  /** Replace the contents of this graph with the graph stored at @a path.
+   * @return false, leaving the graph unchanged, if the file cannot be
+   *         mapped or is not a compatible binary graph
+   * @post On success, node and edge indices, positions, removed entries
+   *       and (if stored) values equal those of the saved graph; values
+   *       not stored are default-constructed.
+   *
+   * The file is memory-mapped and each section is copied into the graph's
+   * arrays in one pass, without going through add_node() and add_edge().
+   * The arrays cannot adopt the mapping directly since they are
+   * std::vectors, so this is one copy, not zero.
+   *
+   * Complexity: O(num_nodes() + num_edges()).
+   */
+  bool load_binary(const std::string& path)
+  {
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0)
+          return false;
+      struct stat st;
+      if (::fstat(fd, &st) != 0 || std::size_t(st.st_size) < sizeof(BinaryHeader)) {
+          ::close(fd);
+          return false;
+      }
+      std::size_t size = st.st_size;
+      void* map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if (map == MAP_FAILED)
+          return false;
+      bool ok = load_binary(static_cast<const char*>(map), size);
+      ::munmap(map, size);
+      return ok;
+  }
+
+  /** Replace the contents of this graph with the binary graph held in the
+   * @a size bytes at @a base, as emitted by write_binary().
+   * @return false, leaving the graph unchanged, if they do not hold a
+   *         compatible binary graph
+   *
+   * Complexity: O(num_nodes() + num_edges()).
+   */
+  bool load_binary(const char* base, std::size_t size)
+  {
+      if (size < sizeof(BinaryHeader))
+          return false;
+      BinaryHeader h;
+      std::memcpy(&h, base, sizeof(h));
+      bool ok = std::memcmp(h.magic, "CMEGRAPH", 8) == 0
+             && h.version >= 1 && h.version <= binary_version
+             && (h.version < 2 ||
+                 (h.removed_nodes <= h.num_nodes && h.removed_edges <= h.num_edges))
+             && ((h.flags & has_node_values) == 0 ||
+                 (std::is_trivially_copyable<node_value_type>::value &&
+                  h.node_value_size == sizeof(node_value_type)))
+             && ((h.flags & has_edge_values) == 0 ||
+                 (std::is_trivially_copyable<edge_value_type>::value &&
+                  h.edge_value_size == sizeof(edge_value_type)));
+
+      // Locate the sections, checking that each lies inside the file
+      std::size_t pos = sizeof(h);
+      auto section = [&](std::size_t bytes) -> const char* {
+          pos = (pos + 7) / 8 * 8;
+          if (pos + bytes > size) {
+              ok = false;
+              return nullptr;
+          }
+          const char* p = base + pos;
+          pos += bytes;
+          return p;
+      };
+      const char* positions   = section(h.num_nodes * sizeof(Point));
+      const char* node_active = section(h.num_nodes);
+      const char* node_values = (h.flags & has_node_values)
+                                ? section(h.num_nodes * h.node_value_size) : nullptr;
+      const char* adj_offsets = section((h.num_nodes + 1) * sizeof(std::uint64_t));
+      const char* adj_targets = section(h.num_adj * sizeof(std::uint32_t));
+      const char* adj_edges   = section(h.num_adj * sizeof(std::uint32_t));
+      const char* adj_active  = section(h.num_adj);
+      (void) adj_active;    // entries of removed edges are dropped instead
+      const char* edge_nodes  = section(h.num_edges * 2 * sizeof(std::uint32_t));
+      const char* edge_active = section(h.num_edges);
+      const char* edge_values = (h.flags & has_edge_values)
+                                ? section(h.num_edges * h.edge_value_size) : nullptr;
+      bool ordered = ok && h.version >= 2;
+      std::uint64_t live_nodes = ordered ? h.num_nodes - h.removed_nodes : 0;
+      std::uint64_t live_edges = ordered ? h.num_edges - h.removed_edges : 0;
+      const char* node_order = ordered
+                               ? section(live_nodes * sizeof(std::uint32_t)) : nullptr;
+      const char* edge_order = ordered
+                               ? section(live_edges * sizeof(std::uint32_t)) : nullptr;
+
+      // Every adjacency entry must name an existing edge
+      for (std::uint64_t k = 0; ok && k < h.num_adj; ++k) {
+          std::uint32_t eid;
+          std::memcpy(&eid, adj_edges + k * sizeof(eid), sizeof(eid));
+          ok = eid < h.num_edges;
+      }
+
+      // The iteration orders, index order if not stored, must list every
+      // live node and edge once
+      std::vector<std::uint32_t> nodes_in_order, edges_in_order;
+      if (ok) {
+          ok = read_order(node_order, node_active, h.num_nodes, live_nodes, nodes_in_order)
+            && read_order(edge_order, edge_active, h.num_edges, live_edges, edges_in_order);
+      }
+
+      if (ok) {
+          clear();
+          reserve(h.num_nodes, h.num_edges);
+
+          for (std::size_t i = 0; i < h.num_nodes; ++i) {
+              Point p;
+              std::memcpy(&p, positions + i * sizeof(Point), sizeof(Point));
+              node_value_type v = node_value_type();
+              if (node_values)
+                  std::memcpy(static_cast<void*>(&v), node_values + i * sizeof(v), sizeof(v));
+              Points.emplace_back(p, v);
+              Nodes.emplace_back(p, v);
+              Nodes.back().Active = node_active[i];
+              // Removed nodes get a handle that is already invalid
+              NodeHandles.push_back(node_handle());
+              if (!node_active[i]) {
+                  NodeHandles.back() = NodeSlots.insert(size_type(i));
+                  NodeSlots.erase(NodeHandles.back());
+                  ++removednodes;
+              }
+          }
+          for (std::uint32_t i : nodes_in_order)
+              NodeHandles[i] = NodeSlots.insert(i);
+
+          EdgeValues.resize(h.num_edges);
+          if (edge_values && h.num_edges)
+              std::memcpy(static_cast<void*>(EdgeValues.data()), edge_values,
+                          h.num_edges * sizeof(edge_value_type));
+          for (std::size_t k = 0; k < h.num_edges; ++k) {
+              std::uint32_t ids[2];
+              std::memcpy(ids, edge_nodes + k * sizeof(ids), sizeof(ids));
+              Edges.emplace_back(ids[0], ids[1]);
+              Edges.back().Active = edge_active[k];
+              EdgeHandles.push_back(edge_handle());
+              if (!edge_active[k]) {
+                  EdgeHandles.back() = EdgeSlots.insert(size_type(k));
+                  EdgeSlots.erase(EdgeHandles.back());
+                  ++removededges;
+              }
+          }
+          for (std::uint32_t k : edges_in_order)
+              EdgeHandles[k] = EdgeSlots.insert(k);
+
+          AdjList.resize(h.num_nodes);
+          EAdjList.resize(h.num_nodes);
+          for (std::size_t i = 0; i < h.num_nodes; ++i) {
+              std::uint64_t b, e;
+              std::memcpy(&b, adj_offsets + i * sizeof(b), sizeof(b));
+              std::memcpy(&e, adj_offsets + (i+1) * sizeof(e), sizeof(e));
+              AdjList[i].reserve(e - b);
+              EAdjList[i].reserve(e - b);
+              // Only the entries of live edges, as kill_edge() leaves them
+              for (std::uint64_t k = b; k < e && k < h.num_adj; ++k) {
+                  std::uint32_t j, eid;
+                  std::memcpy(&j, adj_targets + k * sizeof(j), sizeof(j));
+                  std::memcpy(&eid, adj_edges + k * sizeof(eid), sizeof(eid));
+                  if (!edge_active[eid])
+                      continue;
+                  edge_items& edge = Edges[eid];
+                  (edge.NodeId1 == i ? edge.Pos1 : edge.Pos2) = EAdjList[i].size();
+                  AdjList[i].push_back(j);
+                  EAdjList[i].emplace_back(j, eid);
+              }
+          }
+      }
+      return ok;
   }
 
   //
@@ -763,58 +1613,59 @@ class Graph {
   //
 
   /** @class Graph::NodeIterator
-   * @brief Iterator class for nodes. A forward iterator. */
+   * @brief Iterator class for nodes. A random access iterator.
+   *
+   * Iterates over a dense array of the live nodes, so any position is
+   * reached in O(1) and a range splits into equal parts by arithmetic.
+   * Nodes are visited in the order they were added until one is removed;
+   * removing a node moves the last node into its place in this order. */
   class NodeIterator : private totally_ordered<NodeIterator>{
    public:
     // These type definitions let us use STL's iterator_traits.
     using value_type        = Node;                     // Element type
     using pointer           = Node*;                    // Pointers to elements
-    using reference         = Node&;                    // Reference to elements
+    using reference         = Node;                     // Proxy, by value
     using difference_type   = std::ptrdiff_t;           // Signed difference
-    using iterator_category = std::input_iterator_tag;  // Weak Category, Proxy
+    using iterator_category = std::random_access_iterator_tag;
 
     /** Construct an invalid NodeIterator. */
     NodeIterator() {
     }
 
-    // Custom constructor
-  
-    NodeIterator(const Graph* currentgraph, size_type id)
+    // Custom constructor: the iterator at position pos of the live nodes
+
+    NodeIterator(const Graph* currentgraph, size_type pos)
     {
          GraphPointer = const_cast<Graph*>(currentgraph);
-         NodeId = id;
-
-
-            while(GraphPointer->Nodes[NodeId].Active == 0 and NodeId<GraphPointer->num_nodes())
-            {
-                ++NodeId;
-            }
-
+         Pos = pos;
     }
-    
-    // HW1 #2: YOUR CODE HERE
-    // Supply definitions AND SPECIFICATIONS for:
-    // Node operator*() const
-    // NodeIterator& operator++()
-    // bool operator==(const NodeIterator&) const
 
     /** Dereferences the node iterator
     * @pre @a ni is a valid iterator of this graph and != to node_end()
-    * @return A Node iterator object @a ni with @a *ni == corresponding node
-    * @post @a *ni == corresponding node of current graph
+    * @return the node at the position of @a ni
     *
     * Complexity: No more than O(1) complexity
     */
 
      Node operator*() const
      {
-         assert(NodeId < GraphPointer->num_nodes());
-         return Node(GraphPointer, NodeId);
+         assert(Pos < GraphPointer->NodeSlots.size());
+         return Node(GraphPointer, GraphPointer->NodeSlots.value_at(Pos));
+     }
+
+    /** Return the node @a k positions after this one.
+    * @pre 0 <= position of @a ni + @a k < num_nodes()
+    *
+    * Complexity: No more than O(1) complexity
+    */
+
+     Node operator[](difference_type k) const
+     {
+         return *(*this + k);
      }
 
     /** Forwards the node iterator
     * @pre @a ni is a valid iterator of this graph and != to node_end().
-    * @pre @a ni is dereferencible
     * @return A Node iterator object @a ninext
     * @post @a *ni == node of current graph @a ni != @a ninext
     *
@@ -823,15 +1674,80 @@ class Graph {
 
      node_iterator& operator++() 
      {
-        assert(NodeId < GraphPointer->num_nodes());
-        NodeId++;
+        assert(Pos < GraphPointer->NodeSlots.size());
+        ++Pos;
+	    return *this;
+     }
 
-        while(GraphPointer->Nodes[NodeId].Active==0 and NodeId<GraphPointer->num_nodes())
-        {
-            ++NodeId;
-        }
+     node_iterator operator++(int)
+     {
+        node_iterator old = *this;
+        ++*this;
+        return old;
+     }
 
-	    return *this;
+     /** Moves the node iterator back one position
+     * @pre @a ni != node_begin()
+     *
+     * Complexity: No more than O(1) complexity
+     */
+
+     node_iterator& operator--()
+     {
+        assert(Pos > 0);
+        --Pos;
+        return *this;
+     }
+
+     node_iterator operator--(int)
+     {
+        node_iterator old = *this;
+        --*this;
+        return old;
+     }
+
+     /** Moves the node iterator @a k positions, backwards if @a k < 0
+     * @pre the new position lies in [0, num_nodes()]
+     *
+     * Complexity: No more than O(1) complexity
+     */
+
+     node_iterator& operator+=(difference_type k)
+     {
+        Pos = size_type(difference_type(Pos) + k);
+        assert(Pos <= GraphPointer->NodeSlots.size());
+        return *this;
+     }
+
+     node_iterator& operator-=(difference_type k)
+     {
+        return *this += -k;
+     }
+
+     node_iterator operator+(difference_type k) const
+     {
+        node_iterator it = *this;
+        return it += k;
+     }
+
+     friend node_iterator operator+(difference_type k, const node_iterator& nit)
+     {
+        return nit + k;
+     }
+
+     node_iterator operator-(difference_type k) const
+     {
+        node_iterator it = *this;
+        return it -= k;
+     }
+
+     /** Number of positions from @a nit to this iterator
+     * @pre @a ni and @a nit are iterators of the same graph
+     */
+
+     difference_type operator-(const node_iterator& nit) const
+     {
+        return difference_type(Pos) - difference_type(nit.Pos);
      }
 
       /** Testing whether node iterators are equal
@@ -844,10 +1760,16 @@ class Graph {
 
      bool operator==(const node_iterator& nit) const 
      {
-        assert(NodeId <= GraphPointer->num_nodes() &&
-               nit.NodeId <= nit.GraphPointer->num_nodes());
+        return (GraphPointer == nit.GraphPointer) && (Pos == nit.Pos);
+     }
 
-        return (GraphPointer == nit.GraphPointer) && (NodeId == nit.NodeId);
+     /** Testing whether this iterator comes before @a nit
+     * @pre @a ni and @a nit are iterators of the same graph
+     */
+
+     bool operator<(const node_iterator& nit) const
+     {
+        return Pos < nit.Pos;
      }
 
 
@@ -856,7 +1778,7 @@ class Graph {
 
     friend class Graph;
 
-    size_type NodeId;
+    size_type Pos;   // position in the dense array of live nodes
     const Graph* GraphPointer;
   };
 
@@ -869,13 +1791,7 @@ class Graph {
 
     node_iterator node_begin() const
      {
-         assert(has_node(Node(this,0)));
-         size_type i =0;
-         while(Nodes[i].Active==0)
-         {
-             i++;
-         }
-         return NodeIterator(this, i);
+         return NodeIterator(this, 0);
      }
 
     /** Sets the node iterator to the end
@@ -888,8 +1804,20 @@ class Graph {
 
      node_iterator node_end() const
      {
-         assert(has_node(Node(this,size()-1)));
-         return NodeIterator(this,size());
+         return NodeIterator(this,NodeSlots.size());
+     }
+
+    /** Part @a i of @a parts parts of [node_begin(), node_end()), which
+    * differ in length by at most one node.
+    * @pre 0 <= @a i < @a parts
+    *
+    * Complexity: No more than O(1)
+    */
+
+     std::pair<node_iterator,node_iterator> node_range(size_type i, size_type parts) const
+     {
+         return {node_begin() + split(size(), i, parts),
+                 node_begin() + split(size(), i+1, parts)};
      }
 
   //
@@ -931,6 +1859,8 @@ class Graph {
     * @pre @a ii is a valid incident iterator of this graph and != to edge_end()
     * @return An incident iterator object @a ii with @a *ii == corresponding adjacent edge
     * @post @a *ii == corresponding adjacent edge of current graph
+    * @post (*@a ii).node1() is the node iterated over, (*@a ii).node2() the
+    *       neighbour
     *
     * Complexity: No more than O(1) complexity
     */
@@ -940,7 +1870,8 @@ class Graph {
          //assert(NodeId1 != GraphPointer->EAdjList[NodeId1][NodeId2Idx]
          //&& NodeId1 < GraphPointer->num_nodes());
          //assert(GraphPointer->EAdjList[NodeId1][NodeId2Idx] <= GraphPointer->num_nodes());
-         return Edge(GraphPointer,NodeId1,GraphPointer->EAdjList[NodeId1][NodeId2Idx].NodeId2);
+         auto& item = GraphPointer->EAdjList[NodeId1][NodeId2Idx];
+         return Edge(GraphPointer,NodeId1,item.NodeId2,item.EdgeId);
      }
 
     /** Forwards the incident iterator
@@ -991,50 +1922,55 @@ class Graph {
   //
 
   /** @class Graph::EdgeIterator
-   * @brief Iterator class for edges. A forward iterator. */
+   * @brief Iterator class for edges. A random access iterator.
+   *
+   * Iterates over a dense array of the live edges, like NodeIterator:
+   * edges are visited in the order they were added until one is removed,
+   * which moves the last edge into its place. */
   class EdgeIterator : private totally_ordered<EdgeIterator>{
    public:
     // These type definitions let us use STL's iterator_traits.
     using value_type        = Edge;                     // Element type
     using pointer           = Edge*;                    // Pointers to elements
-    using reference         = Edge&;                    // Reference to elements
+    using reference         = Edge;                     // Proxy, by value
     using difference_type   = std::ptrdiff_t;           // Signed difference
-    using iterator_category = std::input_iterator_tag;  // Weak Category, Proxy
+    using iterator_category = std::random_access_iterator_tag;
 
     /** Construct an invalid EdgeIterator. */
     EdgeIterator() {
     }
 
-    EdgeIterator(const Graph* currentgraph, size_type eid)
+    // Custom constructor: the iterator at position pos of the live edges
+
+    EdgeIterator(const Graph* currentgraph, size_type pos)
     {
         GraphPointer = const_cast<Graph*>(currentgraph);
-        EdgeId = eid;
-
-      /*  while(GraphPointer->Edges[(*this).eid].Active == 0)
-        {
-            ++(this);
-        }
-*/
+        Pos = pos;
     }
 
-    // Supply definitions AND SPECIFICATIONS for:
-    // Edge operator*() const
-    // EdgeIterator& operator++()
-    // bool operator==(const EdgeIterator&) const
-
-
     /** Dereferences the edge iterator
     * @pre @a ei is a valid edge iterator of this graph and != to edge_end()
-    * @return An edge iterator object @a ei with @a *ei == corresponding edge
-    * @post @a *ei == corresponding edge of current graph
+    * @return the edge at the position of @a ei
     *
     * Complexity: No more than O(1) complexity
     */
 
     Edge operator* () const
     {
-        assert(EdgeId < GraphPointer->num_edges());
-        return Edge(GraphPointer,GraphPointer->Edges[EdgeId].NodeId1,GraphPointer->Edges[EdgeId].NodeId2);
+        assert(Pos < GraphPointer->EdgeSlots.size());
+        size_type k = GraphPointer->EdgeSlots.value_at(Pos);
+        return Edge(GraphPointer,GraphPointer->Edges[k].NodeId1,GraphPointer->Edges[k].NodeId2,k);
+    }
+
+    /** Return the edge @a k positions after this one.
+    * @pre 0 <= position of @a ei + @a k < num_edges()
+    *
+    * Complexity: No more than O(1) complexity
+    */
+
+    Edge operator[](difference_type k) const
+    {
+        return *(*this + k);
     }
 
     /** Forwards the edge iterator
@@ -1047,19 +1983,82 @@ class Graph {
 
     edge_iterator& operator++()
     {
-        assert(EdgeId < GraphPointer->num_edges());
-        EdgeId++;
-        while(GraphPointer-> Edges[EdgeId].Active == 0 and EdgeId<GraphPointer->num_edges())
-        {
-            //std::cout<<GraphPointer->Edges[EdgeId].Active<< std::endl;
-            numremnodes++;
-            //std::cout<< "this is count " << numremnodes << std::endl;
-            ++EdgeId;
-        }
+        assert(Pos < GraphPointer->EdgeSlots.size());
+        ++Pos;
+        return *this;
+    }
+
+    edge_iterator operator++(int)
+    {
+        edge_iterator old = *this;
+        ++*this;
+        return old;
+    }
+
+    /** Moves the edge iterator back one position
+    * @pre @a ei != edge_begin()
+    *
+    * Complexity: No more than O(1) complexity
+    */
+
+    edge_iterator& operator--()
+    {
+        assert(Pos > 0);
+        --Pos;
+        return *this;
+    }
+
+    edge_iterator operator--(int)
+    {
+        edge_iterator old = *this;
+        --*this;
+        return old;
+    }
 
+    /** Moves the edge iterator @a k positions, backwards if @a k < 0
+    * @pre the new position lies in [0, num_edges()]
+    *
+    * Complexity: No more than O(1) complexity
+    */
+
+    edge_iterator& operator+=(difference_type k)
+    {
+        Pos = size_type(difference_type(Pos) + k);
+        assert(Pos <= GraphPointer->EdgeSlots.size());
         return *this;
     }
 
+    edge_iterator& operator-=(difference_type k)
+    {
+        return *this += -k;
+    }
+
+    edge_iterator operator+(difference_type k) const
+    {
+        edge_iterator it = *this;
+        return it += k;
+    }
+
+    friend edge_iterator operator+(difference_type k, const edge_iterator& eit)
+    {
+        return eit + k;
+    }
+
+    edge_iterator operator-(difference_type k) const
+    {
+        edge_iterator it = *this;
+        return it -= k;
+    }
+
+    /** Number of positions from @a eit to this iterator
+    * @pre @a ei and @a eit are iterators of the same graph
+    */
+
+    difference_type operator-(const edge_iterator& eit) const
+    {
+        return difference_type(Pos) - difference_type(eit.Pos);
+    }
+
     /** Testing whether edge iterators are equal
     * @pre @a ei and @a eit are valid edge iterators of the current graph
     * @param[in] @a eit, which is a valid edge iterator object
@@ -1070,17 +2069,23 @@ class Graph {
 
     bool operator == (const edge_iterator& eit) const
     {
-        assert(EdgeId <= GraphPointer->num_edges() &&
-               eit.EdgeId <= eit.GraphPointer->num_edges());
-        return (GraphPointer == eit.GraphPointer && EdgeId == eit.EdgeId);
+        return (GraphPointer == eit.GraphPointer && Pos == eit.Pos);
+    }
+
+    /** Testing whether this iterator comes before @a eit
+    * @pre @a ei and @a eit are iterators of the same graph
+    */
+
+    bool operator<(const edge_iterator& eit) const
+    {
+        return Pos < eit.Pos;
     }
    
    private:
     friend class Graph;
 
     const Graph* GraphPointer;
-    size_type EdgeId;
-    int numremnodes=0;
+    size_type Pos;   // position in the dense array of live edges
 
   };
 
@@ -1110,7 +2115,21 @@ class Graph {
 
    edge_iterator edge_end() const
    { 
-       return EdgeIterator(this,Edges.size());
+       return EdgeIterator(this,EdgeSlots.size());
+   }
+
+   /** Part @a i of @a parts parts of [edge_begin(), edge_end()), which
+   * differ in length by at most one edge, e.g. to give each of @a parts
+   * threads an equal share of the edges.
+   * @pre 0 <= @a i < @a parts
+   *
+   * Complexity: No more than O(1)
+   */
+
+   std::pair<edge_iterator,edge_iterator> edge_range(size_type i, size_type parts) const
+   {
+       return {edge_begin() + split(num_edges(), i, parts),
+               edge_begin() + split(num_edges(), i+1, parts)};
    }
 
  private:
@@ -1119,6 +2138,102 @@ class Graph {
   // Use this space for your Graph class's internals:
   //   helper functions, data members, and so forth.
 
+  // Mark node i and its edges removed. O(degree of i).
+  void kill_node(size_type i)
+  {
+      Nodes[i].Active = 0;
+      NodeSlots.erase(NodeHandles[i]);
+      while (!EAdjList[i].empty())
+          kill_edge(EAdjList[i].back().EdgeId);
+      ++removednodes;
+  }
+
+  // Mark edge k removed and take it out of both adjacency lists, so that
+  // incident iteration and degree() only see live edges. O(1).
+  void kill_edge(size_type k)
+  {
+      if (!Edges[k].Active)
+          return;
+      Edges[k].Active = 0;
+      EdgeSlots.erase(EdgeHandles[k]);
+      unlink(Edges[k].NodeId1, k);
+      unlink(Edges[k].NodeId2, k);
+      ++removededges;
+  }
+
+  // Erase edge k from the adjacency lists of its endpoint a by moving the
+  // last entry into its place. AdjList[a] and EAdjList[a] hold the same
+  // neighbours in the same order.
+  void unlink(size_type a, size_type k)
+  {
+      auto& adj = EAdjList[a];
+      size_type p = Edges[k].NodeId1 == a ? Edges[k].Pos1 : Edges[k].Pos2;
+      size_type last = adj.size() - 1;
+      assert(p <= last && adj[p].EdgeId == k);
+      if (p != last)
+      {
+          adj[p] = adj[last];
+          AdjList[a][p] = AdjList[a][last];
+          edge_items& moved = Edges[adj[p].EdgeId];
+          (moved.NodeId1 == a ? moved.Pos1 : moved.Pos2) = p;
+      }
+      adj.pop_back();
+      AdjList[a].pop_back();
+  }
+
+  // Start of part i of n parts of [0, len), as equal as they can be
+  static size_type split(size_type len, size_type i, size_type n)
+  {
+      return size_type(std::uint64_t(len) * i / n);
+  }
+
+  // Compact if more than CompactionThreshold of the nodes or the edges are
+  // removed. Returns whether it did.
+  bool compact_if_fragmented()
+  {
+      if (removednodes <= CompactionThreshold * Nodes.size() &&
+          removededges <= CompactionThreshold * Edges.size())
+          return false;
+      compact();
+      return true;
+  }
+
+  // Read the iteration order section at @a order into @a out, or index
+  // order if it is null. False unless the section lists each of the @a live
+  // active entries of @a active, of @a n entries in all, exactly once.
+  static bool read_order(const char* order, const char* active, std::uint64_t n,
+                         std::uint64_t live, std::vector<std::uint32_t>& out)
+  {
+      out.clear();
+      if (!order) {
+          for (std::uint64_t i = 0; i < n; ++i)
+              if (active[i])
+                  out.push_back(std::uint32_t(i));
+          return true;
+      }
+      std::vector<char> seen(n, 0);
+      out.reserve(live);
+      for (std::uint64_t p = 0; p < live; ++p) {
+          std::uint32_t i;
+          std::memcpy(&i, order + p * sizeof(i), sizeof(i));
+          if (i >= n || !active[i] || seen[i])
+              return false;
+          seen[i] = 1;
+          out.push_back(i);
+      }
+      return true;
+  }
+
+  // Index of the edge between nodes a and b, or Edges.size() if there is
+  // none. O(degree of a).
+  size_type find_edge(size_type a, size_type b) const
+  {
+      for (auto& item : EAdjList[a])
+          if (item.NodeId2 == b)
+              return item.EdgeId;
+      return Edges.size();
+  }
+
  public:
 
     void test_function() {
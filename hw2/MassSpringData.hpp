@@ -0,0 +1,43 @@
+#ifndef CME212_MASSSPRINGDATA_HPP
+#define CME212_MASSSPRINGDATA_HPP
+
+/** @file MassSpringData.hpp
+ * @brief Node and edge values of the mass-spring model and its initial
+ * conditions
+ *
+ * Shared by the mass_spring driver and the tools that write graphs for it
+ * (mesh_gen), so that binary graph files agree on the value layout.
+ */
+
+#include "CME212/Point.hpp"
+
+
+/** Custom structure of data to store with Nodes */
+struct NodeData {
+  Point vel;       //< Node velocity
+  double mass;     //< Node mass
+  NodeData() : vel(0), mass(1) {}
+};
+/** Custom structure of data to store with Edges */
+struct EdgeData{
+  double L;	//Edge spring rest length
+  double K;	//Edge Spring constant
+  EdgeData() : L(0), K(0) {}
+};
+
+/** Set the initial conditions of a freshly loaded mesh: the nodes at rest
+ * with equal masses summing to 1, the springs at rest length with
+ * stiffness 100. */
+template <typename G>
+void set_initial_conditions(G& graph) {
+  for (auto it = graph.node_begin(); it != graph.node_end(); ++it) {
+    (*it).value().mass = (double)1/graph.num_nodes();
+    (*it).value().vel = Point(0,0,0);
+  }
+  for (auto it = graph.edge_begin(); it != graph.edge_end(); ++it) {
+    (*it).value().L = (*it).length();
+    (*it).value().K = 100;
+  }
+}
+
+#endif // CME212_MASSSPRINGDATA_HPP
@@ -0,0 +1,283 @@
+#ifndef CME212_MESHIO_HPP
+#define CME212_MESHIO_HPP
+
+/** @file MeshIO.hpp
+ * @brief Fast loading of the NODES_FILE / TETS_FILE text meshes
+ *
+ * The files are memory-mapped, split into chunks at line boundaries and the
+ * chunks are parsed concurrently with std::from_chars, one thread per chunk.
+ * The format is the one read by CME212::getline_parsed: one record per
+ * line, three doubles per node and four node indices per tetrahedron.
+ * Blank lines and lines starting with '#' are skipped, as are lines that
+ * do not hold a complete record and tetrahedra that do not name four
+ * distinct nodes of the NODES_FILE.
+ */
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "CME212/Point.hpp"
+
+
+/** @class MappedFile
+ * @brief Read-only memory mapping of a whole file.
+ */
+class MappedFile {
+ public:
+  /** Map @a path. Throws std::runtime_error if it cannot be opened. */
+  explicit MappedFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("cannot open " + path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw std::runtime_error("cannot stat " + path);
+    }
+    size_ = st.st_size;
+    if (size_ > 0) {
+      void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        ::close(fd);
+        throw std::runtime_error("cannot map " + path);
+      }
+      ::madvise(p, size_, MADV_SEQUENTIAL);
+      data_ = static_cast<const char*>(p);
+    }
+    ::close(fd);
+  }
+  ~MappedFile() {
+    if (data_)
+      ::munmap(const_cast<char*>(data_), size_);
+  }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const { return data_; }
+  std::size_t size() const { return size_; }
+
+ private:
+  const char* data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+/** Split [@a b, @a e) into at most @a n pieces that end on a newline.
+ * @return the n+1 (or fewer) chunk boundaries, first @a b and last @a e */
+inline std::vector<const char*> split_lines(const char* b, const char* e, unsigned n) {
+  std::vector<const char*> cuts(1, b);
+  std::size_t step = (e - b) / (n ? n : 1) + 1;
+  const char* p = b;
+  while (p < e) {
+    const char* q = (e - p > std::ptrdiff_t(step)) ? p + step : e;
+    while (q < e && *(q-1) != '\n')
+      ++q;
+    cuts.push_back(q);
+    p = q;
+  }
+  if (cuts.size() == 1)
+    cuts.push_back(e);
+  return cuts;
+}
+
+/** Parse up to N numbers of type T from the line [@a p, @a e).
+ * @return true if all N were read */
+template <typename T, std::size_t N>
+bool parse_record(const char* p, const char* e, std::array<T,N>& out) {
+  for (std::size_t k = 0; k < N; ++k) {
+    while (p < e && (*p == ' ' || *p == '\t' || *p == ',' || *p == '\r'))
+      ++p;
+    if (p < e && *p == '+')
+      ++p;
+    auto r = std::from_chars(p, e, out[k]);
+    if (r.ec != std::errc())
+      return false;
+    p = r.ptr;
+  }
+  return true;
+}
+
+/** Parse every line of [@a b, @a e) as a record of N values of type T and
+ * append @a make(record) to @a out. */
+template <typename T, std::size_t N, typename R, typename Make>
+void parse_chunk(const char* b, const char* e, std::vector<R>& out, Make& make) {
+  std::array<T,N> rec;
+  while (b < e) {
+    const char* eol = b;
+    while (eol < e && *eol != '\n')
+      ++eol;
+    if (eol > b && *b != '#' && parse_record(b, eol, rec))
+      out.push_back(make(rec));
+    b = eol + 1;
+  }
+}
+
+/** Parse the file at @a path into records of N values of type T, using up
+ * to @a threads threads, and return @a make(record) for each, in file
+ * order. Every result is stored by its chunk and then copied once into
+ * the returned vector, except those of the first chunk, which are moved. */
+template <typename T, std::size_t N, typename Make>
+auto load_records(const std::string& path, unsigned threads, Make make) {
+  using R = decltype(make(std::declval<const std::array<T,N>&>()));
+  MappedFile file(path);
+  const char* b = file.data();
+  auto cuts = split_lines(b, b + file.size(), threads);
+  std::size_t nchunks = cuts.size() - 1;
+
+  std::vector<std::vector<R>> parts(nchunks);
+  std::vector<std::thread> workers;
+  for (std::size_t c = 1; c < nchunks; ++c)
+    workers.emplace_back([&, c]() { parse_chunk<T,N>(cuts[c], cuts[c+1], parts[c], make); });
+  parse_chunk<T,N>(cuts[0], cuts[1], parts[0], make);
+  for (auto& w : workers)
+    w.join();
+
+  std::size_t total = 0;
+  for (auto& part : parts)
+    total += part.size();
+  std::vector<R> all = std::move(parts[0]);
+  all.reserve(total);
+  for (std::size_t c = 1; c < nchunks; ++c)
+    all.insert(all.end(), parts[c].begin(), parts[c].end());
+  return all;
+}
+
+/** Read a NODES_FILE into a vector of Points. */
+inline std::vector<Point> load_points(const std::string& path, unsigned threads) {
+  return load_records<double,3>(path, threads, [](const std::array<double,3>& r) {
+    return Point(r[0], r[1], r[2]);
+  });
+}
+
+/** Read a TETS_FILE into a vector of node index quadruples. */
+inline std::vector<std::array<int,4>> load_tets(const std::string& path, unsigned threads) {
+  return load_records<int,4>(path, threads, [](const std::array<int,4>& r) { return r; });
+}
+
+/** Whether @a t names four distinct nodes in [0, @a n). */
+inline bool valid_tet(const std::array<int,4>& t, std::size_t n) {
+  for (int k = 0; k < 4; ++k) {
+    if (t[k] < 0 || std::size_t(t[k]) >= n)
+      return false;
+    for (int l = 0; l < k; ++l)
+      if (t[l] == t[k])
+        return false;
+  }
+  return true;
+}
+
+/** The distinct edges of the tetrahedra @a tets over @a n nodes.
+ *
+ * Each tetrahedron has six edges. Every edge is listed once, at its first
+ * occurrence and with the endpoints in that order, which is the order in
+ * which add_edge() on all six edges of every tetrahedron would create
+ * them. Tetrahedra that valid_tet() rejects are skipped.
+ *
+ * Complexity: O(@a n + @a tets.size() times the largest number of
+ * neighbours of a node).
+ */
+template <typename Index>
+std::vector<std::array<unsigned,2>> tet_edges(const std::vector<std::array<Index,4>>& tets,
+                                              std::size_t n) {
+  static constexpr int sides[6][2] = {{0,1}, {0,2}, {0,3}, {1,2}, {1,3}, {2,3}};
+  std::vector<std::array<unsigned,2>> edges;
+  edges.reserve(6 * tets.size());
+  for (auto& t : tets) {
+    std::array<int,4> ti = {int(t[0]), int(t[1]), int(t[2]), int(t[3])};
+    if (!valid_tet(ti, n))
+      continue;
+    for (auto& s : sides)
+      edges.push_back({unsigned(t[s[0]]), unsigned(t[s[1]])});
+  }
+
+  // Bucket every edge by its lower endpoint, as a CSR array sized by a
+  // first counting pass. A bucket holds the higher endpoints seen so far,
+  // a handful per node, so finding a repeat is a short scan
+  std::vector<std::size_t> off(n + 1, 0);
+  for (auto& e : edges)
+    ++off[std::min(e[0], e[1]) + 1];
+  for (std::size_t i = 0; i < n; ++i)
+    off[i+1] += off[i];
+  std::vector<std::size_t> fill(off.begin(), off.end() - 1);
+  std::vector<unsigned> seen(edges.size());
+
+  std::size_t m = 0;
+  for (std::size_t k = 0; k < edges.size(); ++k) {
+    unsigned lo = std::min(edges[k][0], edges[k][1]);
+    unsigned hi = std::max(edges[k][0], edges[k][1]);
+    auto b = seen.begin() + off[lo], e = seen.begin() + fill[lo];
+    if (std::find(b, e, hi) != e)
+      continue;
+    seen[fill[lo]++] = hi;
+    edges[m++] = edges[k];
+  }
+  edges.resize(m);
+  return edges;
+}
+
+/* Detects graphs that can add a list of edges at once, as
+ * @a g.add_edges(pairs) with pairs of node indices */
+template <typename G, typename = void>
+struct has_add_edges : std::false_type {};
+template <typename G>
+struct has_add_edges<G, decltype(void(std::declval<G&>().add_edges(
+    std::declval<const std::vector<std::array<unsigned,2>>&>())))> : std::true_type {};
+
+/** Add the edges @a edges, given as indices into @a nodes, to @a g.
+ * @pre the edges are distinct and none is an edge of @a g yet, as for
+ *      the list returned by tet_edges() for new nodes
+ *
+ * Uses a single add_edges() call if @a g has one, else add_edge() per edge.
+ */
+template <typename G>
+void add_mesh_edges(G& g, const std::vector<typename G::node_type>& nodes,
+                    std::vector<std::array<unsigned,2>> edges) {
+  if constexpr (has_add_edges<G>::value) {
+    for (auto& e : edges)
+      e = {unsigned(nodes[e[0]].index()), unsigned(nodes[e[1]].index())};
+    g.add_edges(edges);
+  }
+  else {
+    for (auto& e : edges)
+      g.add_edge(nodes[e[0]], nodes[e[1]]);
+  }
+}
+
+/** Build @a g from a NODES_FILE and a TETS_FILE.
+ *
+ * Adds one node per point, in file order, and the six edges of every
+ * tetrahedron, as the mass_spring drivers do. Tetrahedra with an index
+ * outside [0, number of points) or a repeated index are skipped. The
+ * graph's storage is reserved up front for the whole mesh, and the edges
+ * are deduplicated by tet_edges() and added in bulk by add_mesh_edges().
+ *
+ * @return the nodes added, in file order
+ */
+template <typename G>
+std::vector<typename G::node_type> load_mesh(G& g, const std::string& nodes_path,
+                                             const std::string& tets_path,
+                                             unsigned threads) {
+  auto pts = load_points(nodes_path, threads);
+  auto edges = tet_edges(load_tets(tets_path, threads), pts.size());
+
+  g.reserve(g.num_nodes() + pts.size(), g.num_edges() + edges.size());
+  std::vector<typename G::node_type> nodes;
+  nodes.reserve(pts.size());
+  for (auto& p : pts)
+    nodes.push_back(g.add_node(p));
+  add_mesh_edges(g, nodes, std::move(edges));
+  return nodes;
+}
+
+#endif // CME212_MESHIO_HPP
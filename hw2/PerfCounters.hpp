@@ -0,0 +1,142 @@
+#ifndef CME212_PERFCOUNTERS_HPP
+#define CME212_PERFCOUNTERS_HPP
+
+/** @file PerfCounters.hpp
+ * @brief Hardware performance counters of the calling thread
+ *
+ * Counts cycles, instructions, L1 data cache read misses, last level cache
+ * misses and branch misses through Linux perf_event_open, in user space
+ * only, which perf_event_paranoid <= 2 allows without privileges. Any
+ * counter the CPU, the kernel or a container refuses is left out and the
+ * others still count; on other systems none are available.
+ */
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+/** @class PerfCounters
+ * @brief One group of counters of the thread that constructed it.
+ *
+ * The counters run from construction on; read() samples all of them at
+ * once. If the kernel multiplexes the group with other users of the PMU,
+ * the values are scaled up to the full running time.
+ *
+ * Threads the owner starts are not counted. attr.inherit would count them,
+ * but their events only reach the owner's counters when they exit, which
+ * long-lived worker threads do not. Each thread opens its own group.
+ */
+class PerfCounters {
+ public:
+  enum Kind { cycles, instructions, l1d_misses, llc_misses, branch_misses, kinds };
+
+  static const char* name(unsigned k) {
+    static const char* names[kinds] = {
+      "cycles", "instructions", "L1d misses", "LLC misses", "branch misses"};
+    return names[k];
+  }
+
+  /** Counter values; only the kinds in mask were counted. */
+  struct Values {
+    std::uint64_t v[kinds] = {};
+    unsigned mask = 0;
+  };
+
+  /** Open the counters of the calling thread. */
+  PerfCounters() {
+#ifdef __linux__
+    static const std::uint32_t types[kinds] = {
+      PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+      PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE};
+    static const std::uint64_t configs[kinds] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    for (unsigned k = 0; k < kinds; ++k) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = types[k];
+      attr.config = configs[k];
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                         PERF_FORMAT_TOTAL_TIME_RUNNING;
+      int fd = int(::syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0));
+      if (fd < 0) {
+        if (error_.empty())
+          error_ = std::string(name(k)) + ": " + std::strerror(errno);
+        continue;
+      }
+      if (leader_ < 0)
+        leader_ = fd;
+      fds_[count_] = fd;
+      order_[count_++] = k;
+    }
+    if (leader_ < 0 && (error_.find("Permission") != std::string::npos ||
+                        error_.find("not permitted") != std::string::npos))
+      error_ += " (see /proc/sys/kernel/perf_event_paranoid)";
+#else
+    error_ = "hardware counters need Linux perf_event_open";
+#endif
+  }
+
+  ~PerfCounters() {
+#ifdef __linux__
+    for (unsigned k = 0; k < count_; ++k)
+      ::close(fds_[k]);
+#endif
+  }
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  /** Whether at least one counter is counting. */
+  bool available() const { return count_ > 0; }
+
+  /** Why the first counter that failed to open did, empty if none did. */
+  const std::string& error() const { return error_; }
+
+  /** Sample all counters into @a out.
+   * @return false if none are available or the read failed */
+  bool read(Values& out) const {
+#ifdef __linux__
+    if (count_ == 0)
+      return false;
+    // nr, time_enabled, time_running, then one value per counter
+    std::uint64_t buf[3 + kinds];
+    ssize_t want = (3 + count_) * sizeof(std::uint64_t);
+    if (::read(leader_, buf, sizeof(buf)) != want || buf[0] != count_)
+      return false;
+    double scale = buf[2] > 0 && buf[2] < buf[1] ? double(buf[1]) / buf[2] : 1.0;
+    out.mask = 0;
+    for (unsigned k = 0; k < count_; ++k) {
+      out.v[order_[k]] = std::uint64_t(buf[3 + k] * scale);
+      out.mask |= 1u << order_[k];
+    }
+    return true;
+#else
+    (void) out;
+    return false;
+#endif
+  }
+
+ private:
+  int leader_ = -1;
+  int fds_[kinds] = {};
+  unsigned order_[kinds] = {};   // kind of the k-th counter in the group
+  unsigned count_ = 0;
+  std::string error_;
+};
+
+#endif // CME212_PERFCOUNTERS_HPP
@@ -0,0 +1,468 @@
+#ifndef CME212_PROFILE_HPP
+#define CME212_PROFILE_HPP
+
+/** @file Profile.hpp
+ * @brief Per-phase timers for the simulation and viewer threads
+ *
+ * Code marks its phases with
+ *
+ *   PROFILE_SCOPE("euler.force");                 // times the enclosing scope
+ *   PhaseClock c(PROFILE_PHASE("euler.force"));   // sums start()..stop()
+ *                                                 // intervals into one sample
+ *
+ * The timers are always compiled in. Until Profiler::instance().enable()
+ * is called each one costs a relaxed atomic load and a branch. Once enabled,
+ * every sample goes into a per-thread log: a log-linear histogram per phase
+ * (for totals, means and percentiles in bounded memory) and, if tracing,
+ * a list of events for a Chrome trace (chrome://tracing, Perfetto).
+ *
+ * With enable_counters(), PROFILE_SCOPE timers also read the thread's
+ * hardware counters (PerfCounters.hpp) at both ends and sum the differences
+ * per phase for counters_report(). Reading them is a system call, so
+ * PhaseClock intervals, which are meant for inner loops, do not. Counters
+ * only see the thread that reads them: work a phase hands to other
+ * threads is counted only if those threads open a PROFILE_SCOPE around
+ * their share. Both reports sum each phase over all threads.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "PerfCounters.hpp"
+
+
+/** @class Profiler
+ * @brief Process-wide registry of phases and per-thread timing logs.
+ */
+class Profiler {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  /** The profiler of this process. */
+  static Profiler& instance() {
+    static Profiler p;
+    return p;
+  }
+
+  /** Start recording; with @a trace also keep up to @a max_events events
+   * per thread for write_trace(). */
+  void enable(bool trace = false, std::size_t max_events = std::size_t(1) << 20) {
+    trace_ = trace;
+    max_events_ = max_events;
+    enabled_.store(true, std::memory_order_relaxed);
+  }
+
+  bool enabled() const {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  /** Also count hardware events in PROFILE_SCOPE phases. Threads whose
+   * counters cannot be opened still record times. */
+  void enable_counters() {
+    counting_.store(true, std::memory_order_relaxed);
+  }
+
+  bool counting() const {
+    return counting_.load(std::memory_order_relaxed);
+  }
+
+  /** Sample the calling thread's counters, opening them on first use.
+   * @return false if it has none */
+  bool read_counters(PerfCounters::Values& v) {
+    ThreadLog& log = thread_log();
+    if (!log.perf) {
+      log.perf.reset(new PerfCounters);
+      if (!log.perf->error().empty()) {
+        std::lock_guard<std::mutex> lock(m_);
+        if (counter_error_.empty())
+          counter_error_ = log.perf->error();
+      }
+    }
+    return log.perf->read(v);
+  }
+
+  /** Add the counts between @a begin and @a end to @a phase. */
+  void record_counters(unsigned phase, const PerfCounters::Values& begin,
+                       const PerfCounters::Values& end) {
+    ThreadLog& log = thread_log();
+    std::lock_guard<std::mutex> lock(log.m);
+    if (log.counts.size() <= phase)
+      log.counts.resize(phase + 1);
+    Counts& c = log.counts[phase];
+    ++c.calls;
+    c.mask |= begin.mask & end.mask;
+    for (unsigned k = 0; k < PerfCounters::kinds; ++k)
+      c.v[k] += end.v[k] - begin.v[k];
+  }
+
+  /** The id of the phase called @a name, registering it if new. */
+  unsigned phase(const char* name) {
+    std::lock_guard<std::mutex> lock(m_);
+    for (unsigned k = 0; k < names_.size(); ++k)
+      if (names_[k] == name)
+        return k;
+    names_.push_back(name);
+    return names_.size() - 1;
+  }
+
+  /** Name the calling thread in reports and traces. */
+  void name_thread(const std::string& name) {
+    ThreadLog& log = thread_log();
+    std::lock_guard<std::mutex> lock(log.m);
+    log.name = name;
+  }
+
+  /** Record one sample of @a phase lasting @a ns nanoseconds, starting at
+   * @a start. */
+  void record(unsigned phase, clock::time_point start, std::uint64_t ns) {
+    ThreadLog& log = thread_log();
+    std::lock_guard<std::mutex> lock(log.m);
+    if (log.stats.size() <= phase)
+      log.stats.resize(phase + 1);
+    log.stats[phase].add(ns);
+    if (trace_ && log.events.size() < max_events_) {
+      auto at = std::chrono::duration_cast<std::chrono::nanoseconds>(start - epoch_).count();
+      log.events.push_back({phase, std::uint64_t(at), ns});
+    }
+  }
+
+  /** Print calls, total, mean, p50, p99 and max of every phase. */
+  void report(std::ostream& os) {
+    std::vector<std::string> names = phase_names();
+    std::vector<Stats> all(names.size());
+    for_each_log([&](ThreadLog& log) {
+      for (std::size_t k = 0; k < log.stats.size(); ++k)
+        all[k].merge(log.stats[k]);
+    });
+    auto flags = os.flags();
+    auto prec = os.precision();
+    os << std::left << std::setw(24) << "phase" << std::right
+       << std::setw(10) << "calls" << std::setw(12) << "total s"
+       << std::setw(12) << "mean us" << std::setw(12) << "p50 us"
+       << std::setw(12) << "p99 us" << std::setw(12) << "max us" << "\n"
+       << std::fixed;
+    for (std::size_t k = 0; k < all.size(); ++k) {
+      const Stats& s = all[k];
+      if (s.count == 0)
+        continue;
+      os << std::left << std::setw(24) << names[k] << std::right
+         << std::setw(10) << s.count
+         << std::setw(12) << std::setprecision(4) << s.total * 1e-9
+         << std::setprecision(2)
+         << std::setw(12) << s.total * 1e-3 / s.count
+         << std::setw(12) << s.percentile(0.50) * 1e-3
+         << std::setw(12) << s.percentile(0.99) * 1e-3
+         << std::setw(12) << s.max * 1e-3 << "\n";
+    }
+    os.flags(flags);
+    os.precision(prec);
+  }
+
+  /** Print cycles, IPC and cache and branch misses of every counted phase,
+   * the misses per call and per one of the @a units items each call
+   * processes (e.g. nodes, for misses per node-step). */
+  void counters_report(std::ostream& os, double units) {
+    std::vector<std::string> names = phase_names();
+    std::vector<Counts> all(names.size());
+    for_each_log([&](ThreadLog& log) {
+      for (std::size_t k = 0; k < log.counts.size(); ++k) {
+        all[k].calls += log.counts[k].calls;
+        all[k].mask |= log.counts[k].mask;
+        for (unsigned j = 0; j < PerfCounters::kinds; ++j)
+          all[k].v[j] += log.counts[k].v[j];
+      }
+    });
+    bool any = false;
+    for (auto& c : all)
+      any = any || c.mask;
+    if (!any) {
+      std::lock_guard<std::mutex> lock(m_);
+      os << "hardware counters unavailable"
+         << (counter_error_.empty() ? "" : ": " + counter_error_) << "\n";
+      return;
+    }
+    auto flags = os.flags();
+    auto prec = os.precision();
+    units = units > 0 ? units : 1;
+    os << std::left << std::setw(24) << "phase" << std::right
+       << std::setw(10) << "calls" << std::setw(12) << "Mcycles" << std::setw(8) << "IPC";
+    for (unsigned j = PerfCounters::l1d_misses; j < PerfCounters::kinds; ++j)
+      os << std::setw(16) << PerfCounters::name(j);
+    os << "\n" << std::setw(54) << "";
+    for (unsigned j = PerfCounters::l1d_misses; j < PerfCounters::kinds; ++j)
+      os << std::setw(16) << "/call /item";
+    os << "\n" << std::fixed;
+    auto has = [](const Counts& c, unsigned j) { return (c.mask >> j) & 1; };
+    for (std::size_t k = 0; k < all.size(); ++k) {
+      const Counts& c = all[k];
+      if (c.calls == 0)
+        continue;
+      os << std::left << std::setw(24) << names[k] << std::right
+         << std::setw(10) << c.calls << std::setprecision(2);
+      if (has(c, PerfCounters::cycles))
+        os << std::setw(12) << c.v[PerfCounters::cycles] * 1e-6;
+      else
+        os << std::setw(12) << "-";
+      if (has(c, PerfCounters::cycles) && has(c, PerfCounters::instructions) &&
+          c.v[PerfCounters::cycles])
+        os << std::setw(8) << double(c.v[PerfCounters::instructions]) / c.v[PerfCounters::cycles];
+      else
+        os << std::setw(8) << "-";
+      for (unsigned j = PerfCounters::l1d_misses; j < PerfCounters::kinds; ++j) {
+        if (!has(c, j)) {
+          os << std::setw(16) << "-";
+          continue;
+        }
+        double per_call = double(c.v[j]) / c.calls;
+        std::ostringstream cell;
+        cell << std::setprecision(per_call < 100 ? 1 : 0) << std::fixed << per_call << " "
+             << std::setprecision(3) << per_call / units;
+        os << std::setw(16) << cell.str();
+      }
+      os << "\n";
+    }
+    os.flags(flags);
+    os.precision(prec);
+  }
+
+  /** Write the recorded events as Chrome trace JSON to @a path.
+   * @return true on success */
+  bool write_trace(const std::string& path) {
+    std::vector<std::string> names = phase_names();
+    std::ofstream out(path);
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    unsigned tid = 0;
+    char buf[64];
+    for_each_log([&](ThreadLog& log) {
+      ++tid;
+      out << (first ? "\n" : ",\n")
+          << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+          << ",\"args\":{\"name\":\"" << log.name << "\"}}";
+      first = false;
+      for (auto& e : log.events) {
+        std::snprintf(buf, sizeof(buf), "%.3f,\"dur\":%.3f", e.start * 1e-3, e.ns * 1e-3);
+        out << ",\n{\"name\":\"" << names[e.phase] << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+            << tid << ",\"ts\":" << buf << "}";
+      }
+    });
+    out << "\n]}\n";
+    out.close();
+    return bool(out);
+  }
+
+  /** Make signal @a signum request a report; see report_requested(). */
+  static void report_on_signal(int signum) {
+    std::signal(signum, [](int) { report_flag_ = 1; });
+  }
+
+  /** Whether a report was requested by signal since the last call. */
+  static bool report_requested() {
+    if (!report_flag_)
+      return false;
+    report_flag_ = 0;
+    return true;
+  }
+
+ private:
+  // Log-linear histogram: exact below 8 ns, then 8 buckets per power of 2
+  struct Stats {
+    static constexpr unsigned buckets = 8 * 62;
+    std::uint64_t count = 0;
+    std::uint64_t total = 0;
+    std::uint64_t max = 0;
+    std::vector<std::uint64_t> hist = std::vector<std::uint64_t>(buckets, 0);
+
+    static unsigned bucket(std::uint64_t v) {
+      if (v < 8)
+        return unsigned(v);
+      unsigned e = 63 - __builtin_clzll(v);
+      return (e - 2) * 8 + unsigned((v >> (e - 3)) & 7);
+    }
+    static double lower(unsigned b) {
+      if (b < 8)
+        return b;
+      unsigned e = b / 8 + 2;
+      return double((8 + b % 8)) * double(std::uint64_t(1) << (e - 3));
+    }
+    void add(std::uint64_t ns) {
+      ++count;
+      total += ns;
+      max = std::max(max, ns);
+      ++hist[bucket(ns)];
+    }
+    void merge(const Stats& s) {
+      count += s.count;
+      total += s.total;
+      max = std::max(max, s.max);
+      for (unsigned b = 0; b < buckets; ++b)
+        hist[b] += s.hist[b];
+    }
+    // Midpoint of the bucket holding the q-quantile, at most max
+    double percentile(double q) const {
+      std::uint64_t rank = std::uint64_t(q * (count - 1));
+      std::uint64_t seen = 0;
+      for (unsigned b = 0; b < buckets; ++b) {
+        seen += hist[b];
+        if (seen > rank)
+          return std::min(double(max), b < 8 ? lower(b) : 0.5 * (lower(b) + lower(b + 1)));
+      }
+      return double(max);
+    }
+  };
+
+  struct Event {
+    unsigned phase;
+    std::uint64_t start;   // ns since the profiler was created
+    std::uint64_t ns;
+  };
+
+  struct Counts {
+    std::uint64_t calls = 0;
+    std::uint64_t v[PerfCounters::kinds] = {};
+    unsigned mask = 0;          // kinds counted in any call
+  };
+
+  struct ThreadLog {
+    std::mutex m;
+    std::string name;
+    std::vector<Stats> stats;   // by phase id
+    std::vector<Event> events;
+    std::vector<Counts> counts; // by phase id
+    std::unique_ptr<PerfCounters> perf;   // used by its thread only
+  };
+
+  Profiler() : epoch_(clock::now()) {}
+
+  ThreadLog& thread_log() {
+    thread_local ThreadLog* log = nullptr;
+    if (!log) {
+      std::lock_guard<std::mutex> lock(m_);
+      logs_.emplace_back(new ThreadLog);
+      log = logs_.back().get();
+      log->name = "thread " + std::to_string(logs_.size());
+    }
+    return *log;
+  }
+
+  template <typename Fn>
+  void for_each_log(Fn fn) {
+    std::lock_guard<std::mutex> lock(m_);
+    for (auto& log : logs_) {
+      std::lock_guard<std::mutex> l(log->m);
+      fn(*log);
+    }
+  }
+
+  std::vector<std::string> phase_names() {
+    std::lock_guard<std::mutex> lock(m_);
+    return names_;
+  }
+
+  std::atomic<bool> enabled_{false};
+  std::atomic<bool> counting_{false};
+  bool trace_ = false;
+  std::size_t max_events_ = 0;
+  clock::time_point epoch_;
+  std::mutex m_;                                  // guards names_, logs_,
+                                                  // counter_error_
+  std::string counter_error_;
+  std::vector<std::string> names_;
+  std::vector<std::unique_ptr<ThreadLog>> logs_;  // never shrinks
+  static inline volatile std::sig_atomic_t report_flag_ = 0;
+};
+
+
+/** Times the scope it lives in as one sample of a phase. */
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(unsigned phase)
+      : phase_(phase), on_(Profiler::instance().enabled()) {
+    if (!on_)
+      return;
+    counted_ = Profiler::instance().counting() &&
+               Profiler::instance().read_counters(counts_);
+    start_ = Profiler::clock::now();
+  }
+  ~ScopedTimer() {
+    if (!on_)
+      return;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Profiler::clock::now() - start_).count();
+    PerfCounters::Values end;
+    if (counted_ && Profiler::instance().read_counters(end))
+      Profiler::instance().record_counters(phase_, counts_, end);
+    Profiler::instance().record(phase_, start_, ns);
+  }
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+ private:
+  unsigned phase_;
+  bool on_;
+  bool counted_ = false;
+  Profiler::clock::time_point start_;
+  PerfCounters::Values counts_;
+};
+
+/** Sums the time between matching start() and stop() calls, e.g. inside a
+ * per-node loop, and records the sum as one sample of a phase when it goes
+ * out of scope. */
+class PhaseClock {
+ public:
+  explicit PhaseClock(unsigned phase)
+      : phase_(phase), on_(Profiler::instance().enabled()) {
+  }
+  ~PhaseClock() {
+    if (on_ && started_)
+      Profiler::instance().record(phase_, first_, total_);
+  }
+  void start() {
+    if (!on_)
+      return;
+    begin_ = Profiler::clock::now();
+    if (!started_) {
+      first_ = begin_;
+      started_ = true;
+    }
+  }
+  void stop() {
+    if (on_)
+      total_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+          Profiler::clock::now() - begin_).count();
+  }
+  PhaseClock(const PhaseClock&) = delete;
+  PhaseClock& operator=(const PhaseClock&) = delete;
+
+ private:
+  unsigned phase_;
+  bool on_;
+  bool started_ = false;
+  std::uint64_t total_ = 0;
+  Profiler::clock::time_point first_, begin_;
+};
+
+/** The phase id for the string literal @a name, looked up once per use. */
+#define PROFILE_PHASE(name) \
+  ([]() { static const unsigned id = Profiler::instance().phase(name); return id; }())
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+
+/** Time the rest of the enclosing scope as phase @a name. */
+#define PROFILE_SCOPE(name) \
+  ScopedTimer PROFILE_CONCAT(profile_scope_, __LINE__)(PROFILE_PHASE(name))
+
+#endif // CME212_PROFILE_HPP
@@ -0,0 +1,218 @@
+#ifndef CME212_SLOTMAP_HPP
+#define CME212_SLOTMAP_HPP
+
+/** @file SlotMap.hpp
+ * @brief A generational slot map: values addressed by stable handles
+ *
+ * A handle is a (slot, generation) pair. The slot never changes while the
+ * value lives, however the map is modified; erasing the value bumps the
+ * slot's generation, so the old handle no longer matches and a later value
+ * reusing the slot gets a new one. Lookups and validity checks are O(1)
+ * without hashing:
+ *
+ *   SlotMap<Particle> particles;
+ *   auto h = particles.insert(p);
+ *   particles.erase(h);
+ *   particles.contains(h)     // false, even once the slot is reused
+ *
+ * Slots are numbered densely from 0, so data kept outside the map can live
+ * in a plain vector of slot_count() entries indexed by Handle::slot, with
+ * contains() telling stale entries apart.
+ *
+ * The values themselves are kept in a separate dense array, in no
+ * particular order: erase() moves the last value into the hole. begin() and
+ * end() iterate over that array and handle_at() names its entries.
+ */
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+
+/** @class SlotMap
+ * @brief Values of type @a T addressed by handles of type
+ * SlotMap<T,Tag>::Handle.
+ *
+ * @a Tag only makes the handles of maps holding the same type for
+ * different purposes distinct types.
+ */
+template <typename T, typename Tag = T>
+class SlotMap {
+ public:
+  using value_type = T;
+  using size_type = std::uint32_t;
+  using iterator = typename std::vector<T>::iterator;
+  using const_iterator = typename std::vector<T>::const_iterator;
+
+  static constexpr size_type npos = size_type(-1);
+
+  /** Stable name of a value. A default-constructed handle names nothing. */
+  struct Handle {
+    size_type slot = npos;
+    size_type generation = 0;
+
+    bool operator==(const Handle& h) const {
+      return slot == h.slot && generation == h.generation;
+    }
+    bool operator!=(const Handle& h) const {
+      return !(*this == h);
+    }
+    bool operator<(const Handle& h) const {
+      return slot < h.slot || (slot == h.slot && generation < h.generation);
+    }
+  };
+
+  /** Number of values. */
+  size_type size() const {
+    return size_type(values_.size());
+  }
+  bool empty() const {
+    return values_.empty();
+  }
+
+  /** Number of slots ever used, an upper bound on Handle::slot. */
+  size_type slot_count() const {
+    return size_type(slots_.size());
+  }
+
+  /** Add @a value, returning its handle.
+   *
+   * Complexity: O(1) amortized.
+   */
+  Handle insert(const T& value) {
+    size_type s = free_;
+    if (s != npos) {
+      free_ = slots_[s].index;
+    } else {
+      s = size_type(slots_.size());
+      slots_.push_back(Slot());
+    }
+    slots_[s].index = size_type(values_.size());
+    values_.push_back(value);
+    owners_.push_back(s);
+    return Handle{s, slots_[s].generation};
+  }
+
+  /** Remove the value named by @a h.
+   * @pre contains(@a h)
+   * @post !contains(@a h)
+   *
+   * Invalidates handle_at() positions and iterators at or after the last
+   * value, which moves into the hole. Other handles stay valid.
+   *
+   * Complexity: O(1).
+   */
+  void erase(Handle h) {
+    assert(contains(h));
+    Slot& s = slots_[h.slot];
+    size_type last = size_type(values_.size()) - 1;
+    if (s.index != last) {
+      values_[s.index] = std::move(values_[last]);
+      owners_[s.index] = owners_[last];
+      slots_[owners_[last]].index = s.index;
+    }
+    values_.pop_back();
+    owners_.pop_back();
+    ++s.generation;
+    s.index = free_;
+    free_ = h.slot;
+  }
+
+  /** Whether @a h names a value of this map.
+   *
+   * Complexity: O(1).
+   */
+  bool contains(Handle h) const {
+    return h.slot < slots_.size() && slots_[h.slot].generation == h.generation
+        && slots_[h.slot].index < values_.size() && owners_[slots_[h.slot].index] == h.slot;
+  }
+
+  /** The value named by @a h.
+   * @pre contains(@a h)
+   *
+   * Complexity: O(1).
+   */
+  T& operator[](Handle h) {
+    assert(contains(h));
+    return values_[slots_[h.slot].index];
+  }
+  const T& operator[](Handle h) const {
+    assert(contains(h));
+    return values_[slots_[h.slot].index];
+  }
+
+  /** Position of the value named by @a h in the dense array.
+   * @pre contains(@a h) */
+  size_type index_of(Handle h) const {
+    assert(contains(h));
+    return slots_[h.slot].index;
+  }
+
+  /** The value at position @a i of the dense array.
+   * @pre @a i < size() */
+  const T& value_at(size_type i) const {
+    assert(i < values_.size());
+    return values_[i];
+  }
+
+  /** Handle of the value at position @a i of the dense array.
+   * @pre @a i < size() */
+  Handle handle_at(size_type i) const {
+    assert(i < values_.size());
+    return Handle{owners_[i], slots_[owners_[i]].generation};
+  }
+
+  iterator begin() { return values_.begin(); }
+  iterator end() { return values_.end(); }
+  const_iterator begin() const { return values_.begin(); }
+  const_iterator end() const { return values_.end(); }
+
+  void reserve(size_type n) {
+    slots_.reserve(n);
+    values_.reserve(n);
+    owners_.reserve(n);
+  }
+
+  /** Remove all values.
+   * @post size() == 0, and every handle given out so far is invalid
+   *
+   * Slots are kept for reuse, with their generations bumped.
+   *
+   * Complexity: O(size()).
+   */
+  void clear() {
+    for (size_type i = 0; i < values_.size(); ++i) {
+      Slot& s = slots_[owners_[i]];
+      ++s.generation;
+      s.index = free_;
+      free_ = owners_[i];
+    }
+    values_.clear();
+    owners_.clear();
+  }
+
+  /** Bytes of the map's arrays in use, and reserved beyond that. */
+  std::size_t bytes() const {
+    return slots_.size() * sizeof(Slot) + values_.size() * sizeof(T)
+         + owners_.size() * sizeof(size_type);
+  }
+  std::size_t reserved_bytes() const {
+    return (slots_.capacity() - slots_.size()) * sizeof(Slot)
+         + (values_.capacity() - values_.size()) * sizeof(T)
+         + (owners_.capacity() - owners_.size()) * sizeof(size_type);
+  }
+
+ private:
+  struct Slot {
+    size_type index = npos;     // position in values_, or the next free slot
+    size_type generation = 0;
+  };
+  std::vector<Slot> slots_;
+  std::vector<T> values_;
+  std::vector<size_type> owners_;   // slot of each value
+  size_type free_ = npos;           // head of the free slot list
+};
+
+#endif // CME212_SLOTMAP_HPP
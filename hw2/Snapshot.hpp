@@ -0,0 +1,342 @@
+#ifndef CME212_SNAPSHOT_HPP
+#define CME212_SNAPSHOT_HPP
+
+/** @file Snapshot.hpp
+ * @brief Position snapshots handed from the simulation to the viewer thread
+ *
+ * The simulation captures the node positions (and, when it changed, the
+ * topology) of its Graph into a PositionFrame and publishes it through a
+ * TripleBuffer. The viewer thread picks up the newest complete frame
+ * whenever it is ready for one. Neither side ever waits for the other.
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+#include "CME212/Point.hpp"
+
+
+/** @class TripleBuffer
+ * @brief Lock-free single-producer, single-consumer latest-value exchange.
+ *
+ * Three buffers rotate between the producer (back), the consumer (front)
+ * and a shared middle slot. publish() swaps the back buffer into the middle
+ * and acquire() swaps the middle into the front if it was published since
+ * the last acquire(). Both are a single atomic exchange, so the producer
+ * never blocks and the consumer always sees whole frames. Frames the
+ * consumer was too slow to pick up are overwritten.
+ */
+template <typename T>
+class TripleBuffer {
+ public:
+  TripleBuffer() : middle_(1), back_(0), front_(2) {}
+
+  /** The buffer the producer fills next. */
+  T& write_buffer() {
+    return bufs_[back_];
+  }
+
+  /** Make the write buffer the latest frame. Producer only. */
+  void publish() {
+    back_ = middle_.exchange(back_ | fresh) & index_mask;
+  }
+
+  /** Take the latest frame if there is a new one. Consumer only.
+   * @return true if read_buffer() now holds a frame not seen before */
+  bool acquire() {
+    if ((middle_.load() & fresh) == 0)
+      return false;
+    front_ = middle_.exchange(front_) & index_mask;
+    return true;
+  }
+
+  /** The frame taken by the last successful acquire(). */
+  const T& read_buffer() const {
+    return bufs_[front_];
+  }
+
+ private:
+  static constexpr unsigned index_mask = 3;
+  static constexpr unsigned fresh = 4;
+
+  T bufs_[3];
+  std::atomic<unsigned> middle_;  // index of the middle buffer | fresh
+  unsigned back_;
+  unsigned front_;
+};
+
+
+/** @class PublishPolicy
+ * @brief Decides on which simulation steps a snapshot is published.
+ *
+ * every_k publishes every @a every steps. rate publishes at most @a hz
+ * times per wall-clock second. adaptive keeps publishing to at most
+ * @a budget of the wall-clock time, based on the measured cost of the
+ * previous publication. Between publications the simulation runs
+ * undisturbed. The default is 60 publications per second.
+ */
+class PublishPolicy {
+ public:
+  enum Mode { every_k, rate, adaptive };
+  using clock = std::chrono::steady_clock;
+  using clock_time = clock::time_point;
+
+  Mode mode = rate;
+  long every = 1;         //< every_k: steps between publications
+  double hz = 60;         //< rate: publications per second
+  double budget = 0.05;   //< adaptive: fraction of time spent publishing
+
+  /** Parse "every:K", "hz:RATE" or "adaptive[:FRACTION]".
+   * @return false if @a spec is not one of those forms */
+  bool parse(const std::string& spec) {
+    auto colon = spec.find(':');
+    std::string arg = colon == std::string::npos ? "" : spec.substr(colon + 1);
+    if (spec.compare(0, 6, "every:") == 0) {
+      mode = every_k;
+      every = std::max(1L, std::stol(arg));
+    }
+    else if (spec.compare(0, 3, "hz:") == 0) {
+      mode = rate;
+      hz = std::stod(arg);
+    }
+    else if (spec.compare(0, 8, "adaptive") == 0) {
+      mode = adaptive;
+      if (!arg.empty())
+        budget = std::stod(arg);
+    }
+    else
+      return false;
+    return true;
+  }
+
+  /** Whether to publish after simulation step @a step (counted from 0). */
+  bool due(long step) const {
+    if (mode == every_k)
+      return (step + 1) % every == 0;
+    double since = seconds(clock::now() - last_);
+    if (mode == rate)
+      return since >= 1.0 / hz;
+    return since * budget >= cost_;
+  }
+
+  /** Record a publication that started at @a start and ended now. */
+  void published(clock_time start) {
+    last_ = clock::now();
+    cost_ = seconds(last_ - start);
+  }
+
+ private:
+  static double seconds(clock::duration d) {
+    return std::chrono::duration<double>(d).count();
+  }
+
+  clock_time last_ = clock::now();
+  double cost_ = 0;
+};
+
+
+/** A named per-node or per-edge quantity copied into a frame. */
+struct FrameField {
+  std::string name;
+  unsigned components = 1;      //< values per node or edge
+  std::vector<double> data;     //< components values per node or edge
+};
+
+/** One published state of the graph.
+ *
+ * pos is indexed by node index; nodes lists the indices of the nodes that
+ * exist and edges their connections. nodes and edges are only recopied
+ * when the graph's topology_version() differs from the one stored here.
+ * node_fields and edge_fields are only filled in by FieldSet::capture(),
+ * indexed like pos and edges respectively.
+ */
+struct PositionFrame {
+  double t = 0;                                 //< simulation time
+  std::size_t version = 0;                      //< topology version of g
+  bool has_topology = false;                    //< nodes/edges filled in
+  std::vector<unsigned> nodes;                  //< indices of the nodes
+  std::vector<Point> pos;                       //< position by node index
+  std::vector<std::array<unsigned,2>> edges;    //< node indices per edge
+  std::vector<FrameField> node_fields;          //< extra data by node index
+  std::vector<FrameField> edge_fields;          //< extra data per edge
+};
+
+/** Copy the state of @a g at time @a t into @a f.
+ *
+ * Positions are always copied; the node and edge lists only when the
+ * topology changed since @a f was last filled.
+ *
+ * Complexity: O(num_nodes()), plus O(num_edges()) on topology changes.
+ */
+template <typename G>
+void capture(const G& g, double t, PositionFrame& f) {
+  f.t = t;
+  if (!f.has_topology || f.version != g.topology_version()) {
+    f.nodes.clear();
+    for (auto it = g.node_begin(); it != g.node_end(); ++it)
+      f.nodes.push_back((*it).index());
+    f.edges.clear();
+    for (auto it = g.edge_begin(); it != g.edge_end(); ++it) {
+      auto e = *it;
+      f.edges.push_back({{e.node1().index(), e.node2().index()}});
+    }
+    f.version = g.topology_version();
+    f.has_topology = true;
+  }
+  f.pos.resize(g.node_index_end());
+  for (auto it = g.node_begin(); it != g.node_end(); ++it) {
+    auto n = *it;
+    f.pos[n.index()] = n.position();
+  }
+}
+
+
+/** @class FieldSet
+ * @brief The node and edge quantities of a Graph to copy into frames.
+ *
+ * Each field is a name, a number of components and a function that writes
+ * the components for one node or edge, e.g.
+ *
+ *   fields.add_node("mass", 1, [](const Node& n, double* out) {
+ *     out[0] = n.value().mass;
+ *   });
+ */
+template <typename G>
+class FieldSet {
+ public:
+  using node_type = typename G::node_type;
+  using edge_type = typename G::edge_type;
+  using node_fn = std::function<void(const node_type&, double*)>;
+  using edge_fn = std::function<void(const edge_type&, double*)>;
+
+  void add_node(const std::string& name, unsigned components, node_fn fn) {
+    nodes_.push_back({name, components, fn});
+  }
+  void add_edge(const std::string& name, unsigned components, edge_fn fn) {
+    edges_.push_back({name, components, fn});
+  }
+
+  /** Copy the fields of @a g into @a f, which must have been filled by
+   * capture(g, t, f) since the last topology change of @a g.
+   *
+   * Complexity: O(num_nodes() + num_edges()) per field.
+   */
+  void capture(const G& g, PositionFrame& f) const {
+    f.node_fields.resize(nodes_.size());
+    for (std::size_t k = 0; k < nodes_.size(); ++k) {
+      FrameField& out = f.node_fields[k];
+      out.name = nodes_[k].name;
+      out.components = nodes_[k].components;
+      out.data.resize(g.node_index_end() * out.components);
+      for (auto it = g.node_begin(); it != g.node_end(); ++it) {
+        auto n = *it;
+        nodes_[k].fn(n, &out.data[n.index() * out.components]);
+      }
+    }
+    f.edge_fields.resize(edges_.size());
+    for (std::size_t k = 0; k < edges_.size(); ++k) {
+      FrameField& out = f.edge_fields[k];
+      out.name = edges_[k].name;
+      out.components = edges_[k].components;
+      out.data.resize(f.edges.size() * out.components);
+      std::size_t i = 0;
+      for (auto it = g.edge_begin(); it != g.edge_end() && i < f.edges.size(); ++it, ++i)
+        edges_[k].fn(*it, &out.data[i * out.components]);
+    }
+  }
+
+ private:
+  template <typename F>
+  struct Field {
+    std::string name;
+    unsigned components;
+    F fn;
+  };
+  std::vector<Field<node_fn>> nodes_;
+  std::vector<Field<edge_fn>> edges_;
+};
+
+
+/** A node of a PositionFrame, usable wherever the viewer expects a node.
+ *
+ * Nodes compare by index only, so a viewer node map built from one frame
+ * still finds the same nodes in later frames with the same topology.
+ */
+class SnapshotNode {
+ public:
+  SnapshotNode() : frame_(nullptr), idx_(0) {}
+  SnapshotNode(const PositionFrame* f, unsigned i) : frame_(f), idx_(i) {}
+
+  const Point& position() const { return frame_->pos[idx_]; }
+  unsigned index() const { return idx_; }
+
+  bool operator==(const SnapshotNode& n) const { return idx_ == n.idx_; }
+  bool operator!=(const SnapshotNode& n) const { return idx_ != n.idx_; }
+  bool operator<(const SnapshotNode& n) const { return idx_ < n.idx_; }
+
+ private:
+  const PositionFrame* frame_;
+  unsigned idx_;
+};
+
+/** An edge of a PositionFrame. */
+class SnapshotEdge {
+ public:
+  SnapshotEdge(const PositionFrame* f, std::size_t i) : frame_(f), idx_(i) {}
+
+  SnapshotNode node1() const { return SnapshotNode(frame_, frame_->edges[idx_][0]); }
+  SnapshotNode node2() const { return SnapshotNode(frame_, frame_->edges[idx_][1]); }
+
+ private:
+  const PositionFrame* frame_;
+  std::size_t idx_;
+};
+
+/** Input iterator over the nodes or edges of a PositionFrame.
+ * Dereferencing returns a proxy by value. */
+template <typename T>
+class SnapshotIterator {
+ public:
+  using value_type        = T;
+  using pointer           = void;
+  using reference         = T;                          // Proxy, by value
+  using difference_type   = std::ptrdiff_t;
+  using iterator_category = std::input_iterator_tag;
+
+  SnapshotIterator(const PositionFrame* f, std::size_t i) : frame_(f), i_(i) {}
+
+  T operator*() const { return make(std::is_same<T, SnapshotNode>()); }
+  SnapshotIterator& operator++() { ++i_; return *this; }
+  bool operator==(const SnapshotIterator& x) const { return i_ == x.i_; }
+  bool operator!=(const SnapshotIterator& x) const { return i_ != x.i_; }
+
+ private:
+  T make(std::true_type) const { return T(frame_, frame_->nodes[i_]); }
+  T make(std::false_type) const { return T(frame_, i_); }
+
+  const PositionFrame* frame_;
+  std::size_t i_;
+};
+
+inline SnapshotIterator<SnapshotNode> node_begin(const PositionFrame& f) {
+  return SnapshotIterator<SnapshotNode>(&f, 0);
+}
+inline SnapshotIterator<SnapshotNode> node_end(const PositionFrame& f) {
+  return SnapshotIterator<SnapshotNode>(&f, f.nodes.size());
+}
+inline SnapshotIterator<SnapshotEdge> edge_begin(const PositionFrame& f) {
+  return SnapshotIterator<SnapshotEdge>(&f, 0);
+}
+inline SnapshotIterator<SnapshotEdge> edge_end(const PositionFrame& f) {
+  return SnapshotIterator<SnapshotEdge>(&f, f.edges.size());
+}
+
+#endif // CME212_SNAPSHOT_HPP
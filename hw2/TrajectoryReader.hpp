@@ -0,0 +1,201 @@
+#ifndef CME212_TRAJECTORYREADER_HPP
+#define CME212_TRAJECTORYREADER_HPP
+
+/** @file TrajectoryReader.hpp
+ * @brief Reading back trajectories written by TrajectoryWriter
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "CME212/Point.hpp"
+
+#include "MeshIO.hpp"
+#include "TrajectoryWriter.hpp"
+
+
+/** One frame read from a trajectory. */
+struct TrajectoryFrame {
+  double t = 0;                 //< simulation time
+  std::vector<unsigned> ids;    //< node index of each entry of pos and vel
+  std::vector<Point> pos;       //< positions
+  std::vector<Point> vel;       //< velocities, if the file has them
+};
+
+/** @class TrajectoryReader
+ * @brief Sequential and, for delta-compressed files, keyframe-indexed
+ * access to a trajectory file.
+ *
+ * The file is memory-mapped. next() decodes the frames in order; seek()
+ * jumps to any keyframe of a delta-compressed file through its index, so
+ * reading frame f costs at most one keyframe interval of decoding.
+ * Throws std::runtime_error if the file is not a trajectory or is
+ * truncated.
+ */
+class TrajectoryReader {
+ public:
+  explicit TrajectoryReader(const std::string& path)
+      : file_(path), path_(path) {
+    const char* p = file_.data();
+    std::size_t header = 16;
+    if (file_.size() < header || std::memcmp(p, "CMETRAJ", 8) != 0)
+      fail("is not a trajectory");
+    std::uint32_t version;
+    std::memcpy(&version, p + 8, sizeof(version));
+    std::memcpy(&flags_, p + 12, sizeof(flags_));
+    if (version != TrajectoryWriter::version)
+      fail("has an unsupported version");
+    end_ = file_.size();
+    if (flags_ & TrajectoryWriter::delta) {
+      double quantum;
+      header += sizeof(quantum);
+      if (file_.size() < header + 16)
+        fail("is truncated");
+      std::memcpy(&quantum, p + 16, sizeof(quantum));
+      pos_coder_ = DeltaCoder(quantum);
+      vel_coder_ = DeltaCoder(quantum);
+      read_index();
+    }
+    at_ = header;
+  }
+
+  /** The flags the file was written with. */
+  std::uint32_t flags() const { return flags_; }
+
+  /** The keyframes of a delta-compressed file, empty otherwise. */
+  const std::vector<TrajectoryKeyframe>& keyframes() const { return index_; }
+
+  /** Continue reading at keyframe @a k. */
+  void seek(std::size_t k) {
+    if (k >= index_.size())
+      throw std::out_of_range("no keyframe " + std::to_string(k) + " in " + path_);
+    at_ = index_[k].topology;
+    if (record() != 'T' || !read_topology())
+      fail("has a bad keyframe index");
+    at_ = index_[k].offset;
+  }
+
+  /** Read the next frame into @a f.
+   * @return false at the end of the file */
+  bool next(TrajectoryFrame& f) {
+    for (;;) {
+      if (at_ + sizeof(std::uint32_t) > end_)
+        return false;
+      std::uint32_t tag = record();
+      if (tag == 'T') {
+        if (!read_topology())
+          fail("is truncated");
+        continue;
+      }
+      if (tag != 'F' && tag != 'K' && tag != 'D')
+        fail("holds an unknown record");
+      std::uint64_t count;
+      if (!get(&f.t, sizeof(f.t)) || !get(&count, sizeof(count)) || count != ids_.size())
+        fail("is truncated");
+      f.ids = ids_;
+      bool vel = flags_ & TrajectoryWriter::velocities;
+      if (tag == 'F') {
+        if (!read_points(f.pos, count) || (vel && !read_points(f.vel, count)))
+          fail("is truncated");
+      }
+      else {
+        bool key = tag == 'K';
+        if (!decode(pos_coder_, f.pos, count, key) ||
+            (vel && !decode(vel_coder_, f.vel, count, key)))
+          fail("holds a corrupt frame");
+      }
+      if (!vel)
+        f.vel.clear();
+      return true;
+    }
+  }
+
+ private:
+  [[noreturn]] void fail(const std::string& what) const {
+    throw std::runtime_error(path_ + " " + what);
+  }
+
+  bool get(void* out, std::size_t bytes) {
+    if (at_ + bytes > end_)
+      return false;
+    std::memcpy(out, file_.data() + at_, bytes);
+    at_ += bytes;
+    return true;
+  }
+
+  std::uint32_t record() {
+    std::uint32_t tag = 0;
+    get(&tag, sizeof(tag));
+    return tag;
+  }
+
+  bool read_topology() {
+    std::uint64_t count;
+    if (!get(&count, sizeof(count)) || count > (end_ - at_) / sizeof(unsigned))
+      return false;
+    ids_.resize(count);
+    return get(ids_.data(), count * sizeof(unsigned));
+  }
+
+  bool read_points(std::vector<Point>& pts, std::uint64_t count) {
+    pts.resize(count);
+    for (auto& x : pts) {
+      if (flags_ & TrajectoryWriter::float32) {
+        float xyz[3];
+        if (!get(xyz, sizeof(xyz)))
+          return false;
+        x = Point(xyz[0], xyz[1], xyz[2]);
+      }
+      else {
+        double xyz[3];
+        if (!get(xyz, sizeof(xyz)))
+          return false;
+        x = Point(xyz[0], xyz[1], xyz[2]);
+      }
+    }
+    return true;
+  }
+
+  bool decode(DeltaCoder& coder, std::vector<Point>& pts, std::uint64_t count, bool key) {
+    auto p = reinterpret_cast<const std::uint8_t*>(file_.data()) + at_;
+    std::size_t used = coder.decode(p, end_ - at_, count, key, pts);
+    at_ += used;
+    return used != 0;
+  }
+
+  // Trailer: uint64 offset of the 'I' record, "CMETRAJI"
+  void read_index() {
+    std::uint64_t at;
+    if (std::memcmp(file_.data() + file_.size() - 8, "CMETRAJI", 8) != 0)
+      fail("has no keyframe index (was it closed?)");
+    std::memcpy(&at, file_.data() + file_.size() - 16, sizeof(at));
+    end_ = file_.size() - 16;
+    if (at > end_)
+      fail("has a bad keyframe index");
+    at_ = at;
+    std::uint64_t count;
+    if (record() != 'I' || !get(&count, sizeof(count)) || count > (end_ - at_) / 24)
+      fail("has a bad keyframe index");
+    index_.resize(count);
+    for (auto& e : index_)
+      if (!get(&e.t, sizeof(e.t)) || !get(&e.offset, sizeof(e.offset)) ||
+          !get(&e.topology, sizeof(e.topology)))
+        fail("has a bad keyframe index");
+    end_ = at;
+  }
+
+  MappedFile file_;
+  std::string path_;
+  std::uint32_t flags_ = 0;
+  std::size_t at_ = 0;          // read position
+  std::size_t end_ = 0;         // end of the frame records
+  std::vector<unsigned> ids_;   // current topology
+  std::vector<TrajectoryKeyframe> index_;
+  DeltaCoder pos_coder_;
+  DeltaCoder vel_coder_;
+};
+
+#endif // CME212_TRAJECTORYREADER_HPP
@@ -0,0 +1,553 @@
+#ifndef CME212_TRAJECTORYWRITER_HPP
+#define CME212_TRAJECTORYWRITER_HPP
+
+/** @file TrajectoryWriter.hpp
+ * @brief Binary trajectory output written by a background I/O thread
+ *
+ * File layout (host byte order):
+ *
+ *   header    "CMETRAJ" '\0', uint32 version, uint32 flags
+ *   records   a sequence of
+ *     'T' topology: uint32 tag, uint64 count, count x uint32 node index
+ *     'F' frame:    uint32 tag, float64 t, uint64 count,
+ *                   count x 3 x real position,
+ *                   count x 3 x real velocity      (if flags & velocities)
+ *
+ * real is float64, or float32 if flags & float32. A frame lists its nodes
+ * in the order of the most recent topology record, which is written before
+ * the first frame and again whenever the graph's topology_version() changes.
+ *
+ * If flags & delta, frames are instead compressed as
+ *     'K' keyframe: uint32 tag, float64 t, uint64 count, coded positions,
+ *                   coded velocities               (if flags & velocities)
+ *     'D' delta:    the same, with tag 'D'
+ * and the file ends with a keyframe index and a trailer
+ *     'I' index:    uint32 tag, uint64 count,
+ *                   count x (float64 t, uint64 keyframe offset,
+ *                            uint64 offset of its topology record)
+ *     trailer:      uint64 offset of the index, "CMETRAJI"
+ * Coordinates are quantized to integer multiples of the header's quantum,
+ * a float64 written after the flags, and each frame stores the residuals of
+ * a prediction (see DeltaCoder). A keyframe only depends on itself and the
+ * topology record before it, so reading can start at any keyframe. Frames
+ * with coordinates too large to quantize are written as 'F' records, and
+ * the next coded frame is a keyframe.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CME212/Point.hpp"
+
+
+/** @class DeltaCoder
+ * @brief Quantizes a sequence of point arrays and codes each one as
+ * prediction residuals.
+ *
+ * Coordinates are rounded to integer multiples of the quantum, so decoding
+ * reproduces them to within quantum/2 and errors never accumulate. In a
+ * keyframe each point is predicted by the previous point in node order,
+ * which is close for meshes whose node order follows their geometry. In
+ * the frames after a keyframe each point is predicted by extrapolating its
+ * last two decoded values (or repeating the last one right after the
+ * keyframe), which is close for smooth motion.
+ *
+ * The residuals are zigzag-mapped to unsigned integers and Rice coded, one
+ * stream per axis, with the Rice parameter chosen from the stream's mean.
+ * Coded layout: uint32 size of the rest, 3 x uint8 Rice parameter, then
+ * the x, y and z bit streams packed LSB first, padded to a whole byte.
+ */
+class DeltaCoder {
+ public:
+  explicit DeltaCoder(double quantum = 1e-6) : quantum_(quantum) {}
+
+  /** Whether every coordinate of @a pts is finite and small enough to
+   * quantize, i.e. less than 2^60 quanta in magnitude. */
+  bool representable(const std::vector<Point>& pts) const {
+    double limit = std::ldexp(quantum_, 60);
+    for (auto& x : pts)
+      if (!(std::abs(x.x) < limit && std::abs(x.y) < limit && std::abs(x.z) < limit))
+        return false;
+    return true;
+  }
+
+  /** Append the coding of @a pts to @a out. */
+  void encode(const std::vector<Point>& pts, bool key, std::vector<std::uint8_t>& out) {
+    std::size_t n = pts.size();
+    cur_.resize(n);
+    for (std::size_t i = 0; i < n; ++i)
+      cur_[i] = {{std::llround(pts[i].x / quantum_), std::llround(pts[i].y / quantum_),
+                  std::llround(pts[i].z / quantum_)}};
+
+    resid_.resize(3 * n);
+    for (int a = 0; a < 3; ++a)
+      for (std::size_t i = 0; i < n; ++i)
+        resid_[a*n + i] = zigzag(cur_[i][a] - predict(i, a, key));
+
+    std::size_t base = out.size();
+    out.resize(base + 7);
+    BitWriter bits(out);
+    for (int a = 0; a < 3; ++a) {
+      unsigned k = rice_parameter(&resid_[a*n], n);
+      out[base + 4 + a] = std::uint8_t(k);
+      for (std::size_t i = 0; i < n; ++i)
+        bits.rice(resid_[a*n + i], k);
+    }
+    bits.flush();
+    std::uint32_t size = std::uint32_t(out.size() - base - 4);
+    std::memcpy(&out[base], &size, sizeof(size));
+    advance(key);
+  }
+
+  /** Decode @a n points from the coding at @a p, of at most @a avail
+   * bytes, into @a pts.
+   * @return the number of bytes used, or 0 if the coding is truncated */
+  std::size_t decode(const std::uint8_t* p, std::size_t avail, std::size_t n, bool key,
+                     std::vector<Point>& pts) {
+    std::uint32_t size;
+    if (avail < 7)
+      return 0;
+    std::memcpy(&size, p, sizeof(size));
+    if (size < 3 || size > avail - 4)
+      return 0;
+    BitReader bits(p + 7, size - 3);
+    cur_.resize(n);
+    for (int a = 0; a < 3; ++a)
+      for (std::size_t i = 0; i < n; ++i)
+        cur_[i][a] = unzigzag(bits.rice(p[4 + a])) + predict(i, a, key);
+    if (bits.overrun())
+      return 0;
+    pts.resize(n);
+    for (std::size_t i = 0; i < n; ++i)
+      pts[i] = Point(cur_[i][0] * quantum_, cur_[i][1] * quantum_, cur_[i][2] * quantum_);
+    advance(key);
+    return 4 + size;
+  }
+
+ private:
+  using qpoint = std::array<std::int64_t,3>;
+
+  // Prediction for coordinate @a a of point @a i; cur_ holds points < i
+  std::int64_t predict(std::size_t i, int a, bool key) const {
+    if (key || i >= prev_.size())
+      return i == 0 ? 0 : cur_[i-1][a];
+    if (depth_ < 2 || i >= prev2_.size())
+      return prev_[i][a];
+    return 2 * prev_[i][a] - prev2_[i][a];
+  }
+
+  void advance(bool key) {
+    depth_ = key ? 1 : depth_ + 1;
+    prev2_.swap(prev_);
+    prev_.swap(cur_);
+  }
+
+  static std::uint64_t zigzag(std::int64_t r) {
+    return (std::uint64_t(r) << 1) ^ std::uint64_t(r >> 63);
+  }
+  static std::int64_t unzigzag(std::uint64_t u) {
+    return std::int64_t(u >> 1) ^ -std::int64_t(u & 1);
+  }
+
+  // Rice parameter close to optimal for a geometric distribution of mean m
+  static unsigned rice_parameter(const std::uint64_t* u, std::size_t n) {
+    double m = 0;
+    for (std::size_t i = 0; i < n; ++i)
+      m += double(u[i]);
+    m = n ? m / n : 0;
+    unsigned k = 0;
+    while (k < 62 && double(std::uint64_t(1) << (k+1)) <= m * 0.69)
+      ++k;
+    return k;
+  }
+
+  // Quotients this large are stored as an escape and the raw value
+  static constexpr unsigned escape = 24;
+
+  struct BitWriter {
+    std::vector<std::uint8_t>& out;
+    std::uint64_t acc = 0;
+    unsigned used = 0;
+    explicit BitWriter(std::vector<std::uint8_t>& o) : out(o) {}
+    void put(std::uint64_t v, unsigned bits) {   // bits <= 32
+      acc |= v << used;
+      used += bits;
+      while (used >= 8) {
+        out.push_back(std::uint8_t(acc));
+        acc >>= 8;
+        used -= 8;
+      }
+    }
+    void rice(std::uint64_t u, unsigned k) {
+      std::uint64_t q = u >> k;
+      if (q < escape) {
+        put((std::uint64_t(1) << q) - 1, unsigned(q) + 1);
+        for (unsigned b = 0; b < k; b += 32)
+          put((u >> b) & ((std::uint64_t(1) << std::min(32u, k - b)) - 1), std::min(32u, k - b));
+      }
+      else {
+        put((std::uint64_t(1) << escape) - 1, escape);
+        put(u & 0xffffffffu, 32);
+        put(u >> 32, 32);
+      }
+    }
+    void flush() {
+      if (used)
+        out.push_back(std::uint8_t(acc));
+      acc = 0;
+      used = 0;
+    }
+  };
+
+  struct BitReader {
+    const std::uint8_t* p;
+    std::size_t size;
+    std::size_t pos = 0;     // in bits
+    BitReader(const std::uint8_t* p_, std::size_t s) : p(p_), size(s) {}
+    bool overrun() const { return pos > 8 * size; }
+    // The next 57 or more bits, zero past the end
+    std::uint64_t peek() const {
+      std::size_t byte = pos >> 3;
+      std::uint64_t w = 0;
+      if (byte + 8 <= size)
+        std::memcpy(&w, p + byte, 8);
+      else
+        for (std::size_t b = byte; b < size; ++b)
+          w |= std::uint64_t(p[b]) << (8 * (b - byte));
+      return w >> (pos & 7);
+    }
+    std::uint64_t get(unsigned bits) {     // bits <= 32
+      std::uint64_t v = peek() & ((std::uint64_t(1) << bits) - 1);
+      pos += bits;
+      return v;
+    }
+    std::uint64_t rice(unsigned k) {
+      std::uint64_t w = ~peek() & ((std::uint64_t(1) << escape) - 1);
+      if (w == 0) {
+        pos += escape;
+        std::uint64_t lo = get(32);
+        return lo | (get(32) << 32);
+      }
+      unsigned q = __builtin_ctzll(w);
+      pos += q + 1;
+      std::uint64_t v = std::uint64_t(q) << k;
+      for (unsigned b = 0; b < k; b += 32)
+        v |= get(std::min(32u, k - b)) << b;
+      return v;
+    }
+  };
+
+  double quantum_;
+  unsigned depth_ = 0;          // frames decoded since the last keyframe
+  std::vector<qpoint> cur_, prev_, prev2_;
+  std::vector<std::uint64_t> resid_;
+};
+
+
+/** Entry of the keyframe index of a delta-compressed trajectory. */
+struct TrajectoryKeyframe {
+  double t;                  //< time of the keyframe
+  std::uint64_t offset;      //< file offset of its 'K' record
+  std::uint64_t topology;    //< file offset of the 'T' record it uses
+};
+
+
+/** @class TrajectoryWriter
+ * @brief Streams simulation frames to disk without stalling the simulation.
+ *
+ * push() copies a frame into a bounded ring of preallocated slots and
+ * returns; a dedicated thread writes the slots out in order. The caller
+ * only waits when all slots are still waiting to be written, i.e. when the
+ * disk cannot keep up; stalls() counts how often that happened.
+ */
+class TrajectoryWriter {
+ public:
+  static constexpr std::uint32_t version = 1;
+  static constexpr std::uint32_t velocities = 1;
+  static constexpr std::uint32_t float32 = 2;
+  static constexpr std::uint32_t delta = 4;
+
+  /** Open @a path for writing with the given @a flags and @a capacity slots.
+   * With the delta flag, coordinates are quantized to multiples of
+   * @a quantum and every @a keyframe_every-th frame is a keyframe; float32
+   * then only applies to frames that cannot be quantized. Throws
+   * std::runtime_error if the file cannot be created. */
+  TrajectoryWriter(const std::string& path, std::uint32_t flags = 0,
+                   std::size_t capacity = 16, double quantum = 1e-6,
+                   unsigned keyframe_every = 64)
+      : flags_(flags), quantum_(quantum), keyframe_every_(keyframe_every ? keyframe_every : 1),
+        ring_(capacity ? capacity : 1), pos_coder_(quantum), vel_coder_(quantum) {
+    f_ = std::fopen(path.c_str(), "wb");
+    if (!f_)
+      throw std::runtime_error("cannot create " + path);
+    const char magic[8] = {'C','M','E','T','R','A','J','\0'};
+    append(magic, sizeof(magic));
+    append(&version, sizeof(version));
+    append(&flags_, sizeof(flags_));
+    if (flags_ & delta)
+      append(&quantum_, sizeof(quantum_));
+    if (!flush()) {
+      std::fclose(f_);
+      throw std::runtime_error("cannot write " + path);
+    }
+    io_ = std::thread([this]() { run(); });
+  }
+
+  /** Flushes every pushed frame and closes the file. */
+  ~TrajectoryWriter() {
+    close();
+  }
+
+  TrajectoryWriter(const TrajectoryWriter&) = delete;
+  TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+  /** Queue the positions of @a g at time @a t. */
+  template <typename G>
+  void push(const G& g, double t) {
+    push(g, t, [](const typename G::node_type&) { return Point(0,0,0); });
+  }
+
+  /** Queue the positions of @a g at time @a t, and the velocities given by
+   * @a vel(n) if the file was opened with the velocities flag. */
+  template <typename G, typename V>
+  void push(const G& g, double t, V vel) {
+    Slot& s = acquire();
+    s.t = t;
+    s.topology = !started_ || g.topology_version() != version_;
+    if (s.topology) {
+      s.ids.clear();
+      for (auto it = g.node_begin(); it != g.node_end(); ++it)
+        s.ids.push_back((*it).index());
+      version_ = g.topology_version();
+      started_ = true;
+    }
+    s.pos.clear();
+    s.vel.clear();
+    for (auto it = g.node_begin(); it != g.node_end(); ++it) {
+      auto n = *it;
+      s.pos.push_back(n.position());
+      if (flags_ & velocities)
+        s.vel.push_back(vel(n));
+    }
+    commit();
+  }
+
+  /** Write out all queued frames, stop the I/O thread and close the file. */
+  void close() {
+    if (!f_)
+      return;
+    {
+      std::lock_guard<std::mutex> lock(m_);
+      closing_ = true;
+    }
+    not_empty_.notify_one();
+    io_.join();
+    if ((flags_ & delta) && !write_index())
+      ++failed_;
+    if (std::fclose(f_) != 0)
+      ++failed_;
+    f_ = nullptr;
+  }
+
+  /** Number of push() calls that had to wait for a free slot. */
+  std::size_t stalls() const { return stalls_; }
+  /** Number of frames that could not be written, plus one if the keyframe
+   * index or the final flush on close() failed. */
+  std::size_t failed() const { return failed_; }
+
+ private:
+  struct Slot {
+    double t;
+    bool topology;
+    std::vector<unsigned> ids;
+    std::vector<Point> pos;
+    std::vector<Point> vel;
+  };
+
+  // Wait for a free slot and hand it to the producer
+  Slot& acquire() {
+    std::unique_lock<std::mutex> lock(m_);
+    if (count_ == ring_.size()) {
+      ++stalls_;
+      not_full_.wait(lock, [this]() { return count_ < ring_.size(); });
+    }
+    return ring_[head_];
+  }
+
+  // Queue the slot filled since acquire()
+  void commit() {
+    {
+      std::lock_guard<std::mutex> lock(m_);
+      head_ = (head_ + 1) % ring_.size();
+      ++count_;
+    }
+    not_empty_.notify_one();
+  }
+
+  // I/O thread: write queued slots in order until closed and drained
+  void run() {
+    for (;;) {
+      std::size_t i;
+      {
+        std::unique_lock<std::mutex> lock(m_);
+        not_empty_.wait(lock, [this]() { return count_ > 0 || closing_; });
+        if (count_ == 0)
+          return;
+        i = tail_;
+      }
+      if (!write(ring_[i]))
+        ++failed_;
+      {
+        std::lock_guard<std::mutex> lock(m_);
+        tail_ = (tail_ + 1) % ring_.size();
+        --count_;
+      }
+      not_full_.notify_one();
+    }
+  }
+
+  // Records are assembled in buf_ and written with one fwrite each
+  void append(const void* p, std::size_t bytes) {
+    auto b = static_cast<const std::uint8_t*>(p);
+    buf_.insert(buf_.end(), b, b + bytes);
+  }
+
+  // File offset of the next byte appended
+  std::uint64_t offset() const {
+    return offset_ + buf_.size();
+  }
+
+  // Write out buf_; false on a short write
+  bool flush() {
+    std::size_t done = std::fwrite(buf_.data(), 1, buf_.size(), f_);
+    offset_ += done;
+    bool ok = done == buf_.size();
+    buf_.clear();
+    return ok;
+  }
+
+  bool write(const Slot& s) {
+    if (s.topology) {
+      topology_offset_ = offset();
+      std::uint32_t tag = 'T';
+      std::uint64_t count = s.ids.size();
+      append(&tag, sizeof(tag));
+      append(&count, sizeof(count));
+      append(s.ids.data(), sizeof(unsigned) * s.ids.size());
+    }
+    if (flags_ & delta)
+      write_delta(s);
+    else
+      write_raw(s);
+    return flush();
+  }
+
+  void write_raw(const Slot& s) {
+    std::uint32_t tag = 'F';
+    std::uint64_t count = s.pos.size();
+    append(&tag, sizeof(tag));
+    append(&s.t, sizeof(s.t));
+    append(&count, sizeof(count));
+    write_points(s.pos);
+    if (flags_ & velocities)
+      write_points(s.vel);
+  }
+
+  // Compressed frame; a keyframe after every topology change and
+  // every keyframe_every_ frames
+  void write_delta(const Slot& s) {
+    bool vel = flags_ & velocities;
+    if (!pos_coder_.representable(s.pos) || (vel && !vel_coder_.representable(s.vel))) {
+      write_raw(s);
+      since_key_ = keyframe_every_;
+      return;
+    }
+    bool key = s.topology || since_key_ + 1 >= keyframe_every_;
+    since_key_ = key ? 0 : since_key_ + 1;
+    if (key)
+      index_.push_back({s.t, offset(), topology_offset_});
+
+    std::uint32_t tag = key ? 'K' : 'D';
+    std::uint64_t count = s.pos.size();
+    append(&tag, sizeof(tag));
+    append(&s.t, sizeof(s.t));
+    append(&count, sizeof(count));
+    pos_coder_.encode(s.pos, key, buf_);
+    if (vel)
+      vel_coder_.encode(s.vel, key, buf_);
+  }
+
+  bool write_index() {
+    std::uint64_t at = offset();
+    std::uint32_t tag = 'I';
+    std::uint64_t count = index_.size();
+    append(&tag, sizeof(tag));
+    append(&count, sizeof(count));
+    for (auto& e : index_) {
+      append(&e.t, sizeof(e.t));
+      append(&e.offset, sizeof(e.offset));
+      append(&e.topology, sizeof(e.topology));
+    }
+    append(&at, sizeof(at));
+    append("CMETRAJI", 8);
+    return flush();
+  }
+
+  void write_points(const std::vector<Point>& pts) {
+    if (flags_ & float32) {
+      for (auto& p : pts) {
+        float xyz[3] = {float(p.x), float(p.y), float(p.z)};
+        append(xyz, sizeof(xyz));
+      }
+    }
+    else {
+      for (auto& p : pts) {
+        double xyz[3] = {p.x, p.y, p.z};
+        append(xyz, sizeof(xyz));
+      }
+    }
+  }
+
+  std::uint32_t flags_;
+  double quantum_;
+  unsigned keyframe_every_;
+  std::FILE* f_ = nullptr;
+
+  // Ring of slots: [tail_, tail_ + count_) are queued, head_ is filled next
+  std::vector<Slot> ring_;
+  std::size_t head_ = 0;
+  std::size_t tail_ = 0;
+  std::size_t count_ = 0;
+  bool closing_ = false;
+  std::size_t stalls_ = 0;
+  std::size_t failed_ = 0;
+  std::mutex m_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::thread io_;
+
+  // Producer side: topology last written
+  bool started_ = false;
+  std::size_t version_ = 0;
+
+  // I/O side: record being assembled, file offset, delta coding state
+  std::vector<std::uint8_t> buf_;
+  std::uint64_t offset_ = 0;
+  std::uint64_t topology_offset_ = 0;
+  unsigned since_key_ = 0;
+  DeltaCoder pos_coder_;
+  DeltaCoder vel_coder_;
+  std::vector<TrajectoryKeyframe> index_;
+};
+
+#endif // CME212_TRAJECTORYWRITER_HPP
@@ -0,0 +1,313 @@
+#ifndef CME212_VTKWRITER_HPP
+#define CME212_VTKWRITER_HPP
+
+/** @file VtkWriter.hpp
+ * @brief VTK time-series output for ParaView, written by a background thread
+ *
+ * Every frame becomes a VTK XML unstructured grid, BASE_NNNNNN.vtu, with
+ * one point per node and one line cell per edge. The node index and the
+ * FieldSet's node fields are point data, its edge fields cell data. The
+ * arrays are stored as raw appended binary (UInt64 size headers), or as
+ * ASCII if requested. BASE.pvd lists the frames with their simulation
+ * times. Each frame appends its entry and rewrites only the closing tags
+ * after it, so the index is complete after every frame and can be opened in
+ * ParaView while the simulation is still running.
+ */
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Snapshot.hpp"
+
+
+/** @class VtkWriter
+ * @brief Streams PositionFrame snapshots to .vtu files and a .pvd index.
+ *
+ * push() captures a frame of the graph, or copies one already captured,
+ * into a bounded ring of frames and returns; the frames are converted and
+ * written by a dedicated thread. The caller only waits when every frame in
+ * the ring is still waiting to be written; stalls() counts how often that
+ * happened.
+ */
+class VtkWriter {
+ public:
+  /** Write BASE.pvd and BASE_NNNNNN.vtu for @a base, in appended binary or
+   * ASCII if @a ascii, queueing up to @a capacity frames. Throws
+   * std::runtime_error if BASE.pvd cannot be created. */
+  explicit VtkWriter(const std::string& base, bool ascii = false, std::size_t capacity = 4)
+      : base_(base), ascii_(ascii), ring_(capacity ? capacity : 1) {
+    auto slash = base_.find_last_of('/');
+    name_ = slash == std::string::npos ? base_ : base_.substr(slash + 1);
+    pvd_ = std::fopen((base_ + ".pvd").c_str(), "wb");
+    if (!pvd_)
+      throw std::runtime_error("cannot create " + base_ + ".pvd");
+    std::fputs("<?xml version=\"1.0\"?>\n"
+               "<VTKFile type=\"Collection\" version=\"0.1\">\n"
+               "  <Collection>\n", pvd_);
+    pvd_end_ = std::ftell(pvd_);
+    if (!finish_pvd()) {
+      std::fclose(pvd_);
+      throw std::runtime_error("cannot write " + base_ + ".pvd");
+    }
+    io_ = std::thread([this]() { run(); });
+  }
+
+  /** Writes every pushed frame. */
+  ~VtkWriter() {
+    close();
+  }
+
+  VtkWriter(const VtkWriter&) = delete;
+  VtkWriter& operator=(const VtkWriter&) = delete;
+
+  /** Queue the state of @a g at time @a t, with the quantities in
+   * @a fields. */
+  template <typename G>
+  void push(const G& g, double t, const FieldSet<G>& fields) {
+    PositionFrame& f = acquire();
+    capture(g, t, f);
+    fields.capture(g, f);
+    commit();
+  }
+
+  /** Queue a copy of @a f, a frame filled by capture() and
+   * FieldSet::capture(), e.g. one also published to the viewer. The node
+   * and edge lists are only copied when the topology changed.
+   *
+   * Complexity: O(num_nodes()), plus O(num_edges()) for edge fields and on
+   * topology changes, without reading the graph.
+   */
+  void push(const PositionFrame& f) {
+    PositionFrame& s = acquire();
+    s.t = f.t;
+    if (!s.has_topology || s.version != f.version) {
+      s.nodes = f.nodes;
+      s.edges = f.edges;
+      s.version = f.version;
+      s.has_topology = true;
+    }
+    s.pos = f.pos;
+    s.node_fields = f.node_fields;
+    s.edge_fields = f.edge_fields;
+    commit();
+  }
+
+  /** Write out all queued frames and stop the I/O thread. */
+  void close() {
+    if (!io_.joinable())
+      return;
+    {
+      std::lock_guard<std::mutex> lock(m_);
+      closing_ = true;
+    }
+    not_empty_.notify_one();
+    io_.join();
+    if (std::fclose(pvd_) != 0)
+      ++failed_;
+  }
+
+  /** Number of push() calls that had to wait for a free frame. */
+  std::size_t stalls() const { return stalls_; }
+  /** Number of frames that could not be written. */
+  std::size_t failed() const { return failed_; }
+
+ private:
+  PositionFrame& acquire() {
+    std::unique_lock<std::mutex> lock(m_);
+    if (count_ == ring_.size()) {
+      ++stalls_;
+      not_full_.wait(lock, [this]() { return count_ < ring_.size(); });
+    }
+    return ring_[head_];
+  }
+
+  void commit() {
+    {
+      std::lock_guard<std::mutex> lock(m_);
+      head_ = (head_ + 1) % ring_.size();
+      ++count_;
+    }
+    not_empty_.notify_one();
+  }
+
+  // I/O thread: write queued frames in order until closed and drained
+  void run() {
+    for (;;) {
+      std::size_t i;
+      {
+        std::unique_lock<std::mutex> lock(m_);
+        not_empty_.wait(lock, [this]() { return count_ > 0 || closing_; });
+        if (count_ == 0)
+          return;
+        i = tail_;
+      }
+      if (!write(ring_[i]))
+        ++failed_;
+      {
+        std::lock_guard<std::mutex> lock(m_);
+        tail_ = (tail_ + 1) % ring_.size();
+        --count_;
+      }
+      not_full_.notify_one();
+    }
+  }
+
+  static const char* vtk_type(const double*) { return "Float64"; }
+  static const char* vtk_type(const std::int64_t*) { return "Int64"; }
+  static const char* vtk_type(const std::uint8_t*) { return "UInt8"; }
+
+  // Add a DataArray to the XML in @a xml, and its data to appended_
+  template <typename T>
+  void array(std::ostream& xml, const std::string& name, unsigned components,
+             const std::vector<T>& data) {
+    xml << "        <DataArray type=\"" << vtk_type(data.data()) << "\"";
+    if (!name.empty())
+      xml << " Name=\"" << name << "\"";
+    xml << " NumberOfComponents=\"" << components << "\"";
+    if (ascii_) {
+      xml << " format=\"ascii\">\n          ";
+      xml.precision(17);
+      for (std::size_t k = 0; k < data.size(); ++k)
+        xml << +data[k] << ((k + 1) % 12 == 0 ? "\n          " : " ");
+      xml << "\n        </DataArray>\n";
+      return;
+    }
+    xml << " format=\"appended\" offset=\"" << appended_.size() << "\"/>\n";
+    std::uint64_t bytes = data.size() * sizeof(T);
+    const char* h = reinterpret_cast<const char*>(&bytes);
+    appended_.insert(appended_.end(), h, h + sizeof(bytes));
+    const char* p = reinterpret_cast<const char*>(data.data());
+    appended_.insert(appended_.end(), p, p + bytes);
+  }
+
+  bool write(const PositionFrame& f) {
+    std::size_t np = f.nodes.size(), nc = f.edges.size();
+
+    // Points are the existing nodes in f.nodes order
+    std::vector<std::int64_t> point(f.pos.size(), -1);
+    std::vector<double> xyz(3 * np);
+    std::vector<std::int64_t> index(np);
+    for (std::size_t i = 0; i < np; ++i) {
+      unsigned n = f.nodes[i];
+      point[n] = i;
+      index[i] = n;
+      xyz[3*i] = f.pos[n].x;
+      xyz[3*i+1] = f.pos[n].y;
+      xyz[3*i+2] = f.pos[n].z;
+    }
+    std::vector<std::int64_t> conn(2 * nc), offsets(nc);
+    std::vector<std::uint8_t> types(nc, 3);   // VTK_LINE
+    for (std::size_t e = 0; e < nc; ++e) {
+      conn[2*e] = point[f.edges[e][0]];
+      conn[2*e+1] = point[f.edges[e][1]];
+      offsets[e] = 2 * (e + 1);
+    }
+
+    appended_.clear();
+    std::ostringstream xml;
+    xml << "<?xml version=\"1.0\"?>\n"
+        << "<VTKFile type=\"UnstructuredGrid\" version=\"1.0\""
+        << " byte_order=\"LittleEndian\" header_type=\"UInt64\">\n"
+        << "  <UnstructuredGrid>\n"
+        << "    <Piece NumberOfPoints=\"" << np << "\" NumberOfCells=\"" << nc << "\">\n"
+        << "      <PointData>\n";
+    array(xml, "node_index", 1, index);
+    std::vector<double> values;
+    for (auto& field : f.node_fields) {
+      values.resize(np * field.components);
+      for (std::size_t i = 0; i < np; ++i)
+        for (unsigned c = 0; c < field.components; ++c)
+          values[i * field.components + c] = field.data[f.nodes[i] * field.components + c];
+      array(xml, field.name, field.components, values);
+    }
+    xml << "      </PointData>\n"
+        << "      <CellData>\n";
+    for (auto& field : f.edge_fields)
+      array(xml, field.name, field.components, field.data);
+    xml << "      </CellData>\n"
+        << "      <Points>\n";
+    array(xml, "", 3, xyz);
+    xml << "      </Points>\n"
+        << "      <Cells>\n";
+    array(xml, "connectivity", 1, conn);
+    array(xml, "offsets", 1, offsets);
+    array(xml, "types", 1, types);
+    xml << "      </Cells>\n"
+        << "    </Piece>\n"
+        << "  </UnstructuredGrid>\n";
+
+    char num[16];
+    std::snprintf(num, sizeof(num), "_%06zu.vtu", frames_);
+    std::string file = name_ + num;
+    std::ofstream out(dir() + file, std::ios::binary);
+    out << xml.str();
+    if (!ascii_) {
+      out << "  <AppendedData encoding=\"raw\">\n   _";
+      out.write(appended_.data(), appended_.size());
+      out << "\n  </AppendedData>\n";
+    }
+    out << "</VTKFile>\n";
+    out.close();
+    if (!out)
+      return false;
+
+    ++frames_;
+    return append_pvd(f.t, file);
+  }
+
+  // Add a frame to the time-series index. Entries are only ever appended,
+  // so this overwrites the closing tags and writes them again after the
+  // new entry: O(1) per frame.
+  bool append_pvd(double t, const std::string& file) {
+    if (std::fseek(pvd_, pvd_end_, SEEK_SET) != 0)
+      return false;
+    std::fprintf(pvd_, "    <DataSet timestep=\"%.17g\" part=\"0\" file=\"%s\"/>\n",
+                 t, file.c_str());
+    pvd_end_ = std::ftell(pvd_);
+    return finish_pvd();
+  }
+
+  // Write the closing tags at the end of the index and flush it
+  bool finish_pvd() {
+    std::fputs("  </Collection>\n"
+               "</VTKFile>\n", pvd_);
+    return std::fflush(pvd_) == 0 && !std::ferror(pvd_);
+  }
+
+  std::string dir() const {
+    return base_.substr(0, base_.size() - name_.size());
+  }
+
+  std::string base_;
+  std::string name_;    // base_ without its directory
+  bool ascii_;
+
+  // Ring of frames: [tail_, tail_ + count_) are queued, head_ is filled next
+  std::vector<PositionFrame> ring_;
+  std::size_t head_ = 0;
+  std::size_t tail_ = 0;
+  std::size_t count_ = 0;
+  bool closing_ = false;
+  std::size_t stalls_ = 0;
+  std::mutex m_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::thread io_;
+
+  // I/O side: the index, open for appending, and frames written to it
+  std::FILE* pvd_ = nullptr;
+  long pvd_end_ = 0;    // offset of the index's closing tags
+  std::size_t frames_ = 0;
+  std::vector<char> appended_;
+  std::size_t failed_ = 0;
+};
+
+#endif // CME212_VTKWRITER_HPP
@@ -11,7 +11,19 @@
 #include <fstream>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <map>
+#include <memory>
 #include <math.h>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <tuple>
+#include <type_traits>
 
 #include "CME212/SFML_Viewer.hpp"
 #include "CME212/Util.hpp"
@@ -19,6 +31,14 @@
 #include "CME212/Point.hpp"
 
 #include "Graph.hpp"
+#include "AllocCounter.hpp"
+#include "Checkpoint.hpp"
+#include "MassSpringData.hpp"
+#include "MeshIO.hpp"
+#include "Profile.hpp"
+#include "Snapshot.hpp"
+#include "TrajectoryWriter.hpp"
+#include "VtkWriter.hpp"
 
 
 // Gravity in meters/sec^2
@@ -26,95 +46,178 @@ static constexpr double grav = 9.81;
 //damping constant
 double c;
 
-/** Custom structure of data to store with Nodes */
-struct NodeData {
-  Point vel;       //< Node velocity
-  double mass;     //< Node mass
-  NodeData() : vel(0), mass(1) {}
-};
-/** Custom structure of data to store with Edges */
-struct EdgeData{
-  double L;	//Edge spring rest length
-  double K;	//Edge Spring constant
-  EdgeData() : L(0), K(0) {}
-};
 // Define the Graph type
 using GraphType = Graph<NodeData,EdgeData>;
 using Node = typename GraphType::node_type;
 using Edge = typename GraphType::edge_type;
 
+/** Apply the per-node constraint @a cons to every node of @a g in one sweep.
+ * @a cons.project(n, t) corrects node n in place and returns false if n
+ * must be removed from the graph instead. */
+template<typename G, typename C>
+void constraint_sweep(G& g, double t, C& cons){
+	auto it=g.node_begin();
+	while(it!=g.node_end()){
+		if(cons.project(*it,t))
+			++it;
+		else
+			it=g.remove_node(it);
+	}
+}
+
 /*Plane constraint*/
 struct plane_constraint{
-	void operator()(GraphType& g, double t){
+	template<typename NODE>
+	bool project(NODE n, double t){
 		(void) t;
-		for(auto it=g.node_begin(); it != g.node_end(); ++it){
-			if((*it).position().z < -0.75)	//if this node violates the constraint 
- 			{
-				(*it).position().z = -0.75;
-				(*it).value().vel.z = 0;
-			}
+		if(n.position().z < -0.75)	//if this node violates the constraint 
+		{
+			n.position().z = -0.75;
+			n.value().vel.z = 0;
 		}
+		return true;
+	}
+	template<typename G>
+	void operator()(G& g, double t){
+		constraint_sweep(g,t,*this);
 	}
 };
 /*Sphere constraint*/
 struct sphere_constraint{
-	template<typename G>
-	void operator()(G& g, double t){
+	template<typename NODE>
+	bool project(NODE n, double t){
 		(void) t;
 		Point c = Point(0.5,0.5,-0.5);
 		double r = 0.15;
-		for(auto it=g.node_begin(); it != g.node_end(); ++it){
-			double dist = norm((*it).position()-c);
-			if(dist < r)	//if this node violates the constraint 
- 			{
-				Point ri = ((*it).position()-c)/dist;
-				(*it).position() = c+r*ri;
-				(*it).value().vel = (*it).value().vel - ((*it).value().vel*ri)*ri;
-			}
+		double dist = norm(n.position()-c);
+		if(dist < r)	//if this node violates the constraint 
+		{
+			Point ri = (n.position()-c)/dist;
+			n.position() = c+r*ri;
+			n.value().vel = n.value().vel - (n.value().vel*ri)*ri;
 		}
+		return true;
+	}
+	template<typename G>
+	void operator()(G& g, double t){
+		constraint_sweep(g,t,*this);
 	}
 };
 /*Sphere constraint to remove nodes*/
 struct sphere_constraint2{
-	template<typename G>
-	void operator()(G& g, double t){
+	template<typename NODE>
+	bool project(NODE n, double t){
 		(void) t;
 		Point c = Point(0.5,0.5,-0.5);
 		double r = 0.15;
-		auto it=g.node_begin();
-		while(it!=g.node_end()){
-			double dist = norm((*it).position()-c);
-			if(dist < r)	//if this node violates the constraint 
- 			{
-				it=g.remove_node(it);
-			}
-			else
-				++it;
-		}
+		return norm(n.position()-c) >= r;	//remove the node if it violates the constraint
+	}
+	template<typename G>
+	void operator()(G& g, double t){
+		constraint_sweep(g,t,*this);
 	}
 };
-/* To combine two constraints */
-template<typename Cons1, typename Cons2>
+
+/* Detects whether a constraint can be applied node by node */
+template<typename C, typename = void>
+struct has_project : std::false_type {};
+template<typename C>
+struct has_project<C, decltype(void(std::declval<C&>().project(std::declval<Node>(), 0.0)))> : std::true_type {};
+
+/** Any number of constraints applied in order.
+ *
+ * When every term has a per-node project(), the terms are fused into one
+ * sweep over the nodes that applies them all to a node before moving on,
+ * instead of one full sweep per term. Otherwise each term is called on the
+ * whole graph in turn. */
+template<typename... Cons>
 struct combined_constraint{
-	Cons1 c1_;
-	Cons2 c2_;
-	combined_constraint(Cons1 c1=Cons1(), Cons2 c2=Cons2()):c1_(c1),c2_(c2){}
-	void operator()(GraphType& g, double t){
-		c1_(g,t);
-		c2_(g,t);
+	std::tuple<Cons...> cons_;
+	combined_constraint(Cons... cons):cons_(cons...){}
+
+	template<typename NODE>
+	bool project(NODE n, double t){
+		return std::apply([&](auto&... c){ return (c.project(n,t) && ...); }, cons_);
+	}
+	template<typename G>
+	void operator()(G& g, double t){
+		if constexpr ((has_project<Cons>::value && ...))
+			constraint_sweep(g,t,*this);
+		else
+			std::apply([&](auto&... c){ (c(g,t), ...); }, cons_);
 	}
 };
-/* To combine two constraints, used as a helper function to combined_constraints*/
-template<typename Cons1, typename Cons2>
-combined_constraint<Cons1,Cons2> make_combined_constraint(Cons1 C1, Cons2 C2){
-	return combined_constraint<Cons1, Cons2>(C1,C2);
+/* Combines any number of constraints, used as a helper function to combined_constraint*/
+template<typename... Cons>
+combined_constraint<Cons...> make_combined_constraint(Cons... C){
+	return combined_constraint<Cons...>(C...);
 }
-/* To combine three constraints, used as a helper function to combined_constraints*/
-template<typename Cons1, typename Cons2, typename Cons3>
-combined_constraint<combined_constraint<Cons1,Cons2>, Cons3> make_combined_constraint(Cons1 C1, Cons2 C2, Cons3 C3){
-	return combined_constraint<combined_constraint<Cons1, Cons2>, Cons3>(combined_constraint<Cons1,Cons2>(C1,C2),C3);
+
+/** A view of a contiguous array of Points, indexed by node index.
+ * Same interface as std::span<Point>, which C++17 does not have yet. */
+class PointSpan{
+ public:
+	PointSpan(Point* data, std::size_t size):data_(data),size_(size){}
+	PointSpan(std::vector<Point>& v):data_(v.data()),size_(v.size()){}
+	Point& operator[](std::size_t i) const { return data_[i]; }
+	Point* data() const { return data_; }
+	std::size_t size() const { return size_; }
+	Point* begin() const { return data_; }
+	Point* end() const { return data_+size_; }
+ private:
+	Point* data_;
+	std::size_t size_;
+};
+
+/** Detects batch forces, called once per step as
+ * @a force.apply(g, t, out). A batch force adds the force on every node n
+ * of g to out[n.index()]; the caller zeroes @a out beforehand. */
+template<typename F, typename G, typename = void>
+struct is_batch_force : std::false_type {};
+template<typename F, typename G>
+struct is_batch_force<F, G, decltype(void(std::declval<F&>().apply(
+	std::declval<const G&>(), 0.0, std::declval<PointSpan>())))> : std::true_type {};
+
+/** Batch adapter for a per-node force called as @a f(n, t) */
+template<typename F>
+struct batch_force_adapter{
+	F f_;
+	batch_force_adapter(F f=F()):f_(f){}
+	template<typename G>
+	void apply(const G& g, double t, PointSpan out){
+		for(auto it = g.node_begin(); it != g.node_end(); ++it){
+			auto n = *it;
+			out[n.index()] += f_(n, t);
+		}
+	}
+};
+/* Returns @a f if it is already a batch force, otherwise wraps it */
+template<typename G, typename F>
+auto make_batch_force(F f){
+	if constexpr (is_batch_force<F, G>::value)
+		return f;
+	else
+		return batch_force_adapter<F>(f);
 }
 
+/** Reusable per-node buffers for the batch symp_euler_step() and fused_step().
+ *
+ * Sized to the graph's node index range once and kept between steps, so a
+ * step performs no allocation unless the graph grows. It is scratch space
+ * of the solver, not graph state, so the driver owns it next to the graph
+ * and keeps it indexed like the nodes through Graph::on_compact().
+ */
+struct StepWorkspace{
+	std::vector<Point> force;	//< accumulated spring force per node index
+
+	/** Make room for every node index of @a g. */
+	template<typename G>
+	void update(const G& g){
+		if(force.size() != g.node_index_end())
+			force.assign(g.node_index_end(), Point(0,0,0));
+	}
+};
+
 /** Change a graph's nodes according to a step of the symplectic Euler
  *    method with the given node force.
  * @param[in,out] g      Graph
@@ -128,37 +231,95 @@ combined_constraint<combined_constraint<Cons1,Cons2>, Cons3> make_combined_const
  *           where n is a node of the graph and @a t is the current time.
  *           @a force must return a Point representing the force vector on
  *           Node n at time @a t.
+ *           If F is a batch force (see is_batch_force) it is preferred and
+ *           called once per step as @a force.apply(g, @a t, out).
  */
 template <typename G, typename F>
-double symp_euler_step(G& g, double t, double dt, F force) {
+std::enable_if_t<!is_batch_force<F, G>::value, double>
+symp_euler_step(G& g, double t, double dt, F force) {
   // Compute the t+dt position
-  for (auto it = g.node_begin(); it != g.node_end(); ++it) {
-    auto n = *it;
+  {
+    PROFILE_SCOPE("euler.position");
+    for (auto it = g.node_begin(); it != g.node_end(); ++it) {
+      auto n = *it;
+
+      // Update the position of the node according to its velocity
+      // x^{n+1} = x^{n} + v^{n} * dt
+      n.position() += n.value().vel * dt;
+    }
+  }
 
-    // Update the position of the node according to its velocity
-    // x^{n+1} = x^{n} + v^{n} * dt
-    n.position() += n.value().vel * dt;
+  // Apply the constraints once, before the velocity loop: they can remove
+  // nodes and compact the graph, which must not happen while iterating
+  {
+    PROFILE_SCOPE("euler.constraints");
+    auto c = make_combined_constraint(sphere_constraint2(),plane_constraint());
+    c(g,t);
   }
 
   // Compute the t+dt velocity
+  PROFILE_SCOPE("euler.velocity");
+  PhaseClock force_clock(PROFILE_PHASE("euler.force"));
   for (auto it = g.node_begin(); it != g.node_end(); ++it) {
     auto n = *it;
 
     // v^{n+1} = v^{n} + F(x^{n+1},t) * dt / m
-	
-    //Check constraint and then update
     if(n.position()!=Point(0,0,0) && n.position()!=Point(1,0,0))
     {
-	//apply constraints
-	auto c = make_combined_constraint(sphere_constraint2(),plane_constraint());
-	c(g,t);
-	//update velocties
-	n.value().vel += force(n, t) * (dt / n.value().mass);
+	force_clock.start();
+	Point f = force(n, t);
+	force_clock.stop();
+	n.value().vel += f * (dt / n.value().mass);
+    }
+  }
+  return t + dt;
+}
+
+/** Symplectic Euler step with a batch force.
+ *
+ * Same update as above, with @a force.apply(g, t, out) called once for all
+ * nodes after the position update and the constraints. The forces are
+ * accumulated in @a ws, which is cleared in the position sweep and reused
+ * between steps.
+ */
+template <typename G, typename F>
+std::enable_if_t<is_batch_force<F, G>::value, double>
+symp_euler_step(G& g, double t, double dt, F force, StepWorkspace& ws) {
+  ws.update(g);
+  {
+    PROFILE_SCOPE("euler.position");
+    for (auto it = g.node_begin(); it != g.node_end(); ++it) {
+      auto n = *it;
+      n.position() += n.value().vel * dt;
+      ws.force[n.index()] = Point(0,0,0);
     }
   }
+  {
+    PROFILE_SCOPE("euler.constraints");
+    auto c = make_combined_constraint(sphere_constraint2(),plane_constraint());
+    c(g,t);
+  }
+  {
+    PROFILE_SCOPE("euler.force");
+    force.apply(g, t, PointSpan(ws.force));
+  }
+  PROFILE_SCOPE("euler.velocity");
+  for (auto it = g.node_begin(); it != g.node_end(); ++it) {
+    auto n = *it;
+    if(n.position()!=Point(0,0,0) && n.position()!=Point(1,0,0))
+      n.value().vel += ws.force[n.index()] * (dt / n.value().mass);
+  }
   return t + dt;
 }
 
+/** Symplectic Euler step with a batch force and a buffer for this step only */
+template <typename G, typename F>
+std::enable_if_t<is_batch_force<F, G>::value, double>
+symp_euler_step(G& g, double t, double dt, F force) {
+  StepWorkspace ws;
+  return symp_euler_step(g, t, dt, force, ws);
+}
+
 /** Force function object for HW2 #1. */
 struct Problem1Force {
   /** Return the force applying to @a n at time @a t.
@@ -176,20 +337,12 @@ struct Problem1Force {
     double mi = n.value().mass;
     
     Point spring = Point(0,0,0);
-    for (auto it = n.edge_begin(); it!=n.edge_end(); ++it)
+    for (auto nb : n.neighbors())
     {
-	Point p1 = n.position();
-        Point p2 = (*it).node2().position();
-	if(p1.x==p2.x && p1.y==p2.y && p1.z==p2.z)
-		p2=(*it).node1().position();
-	
-        double L = (*it).value().L;
-	double K = (*it).value().K;
-
- 	Point xi_xj = p1-p2;
+ 	Point xi_xj = n.position()-nb.position;
         
 	double ed = norm(xi_xj);
-        spring+=(-1.0)*K*(xi_xj)*(ed-L)/(double)ed;
+        spring+=(-1.0)*nb.value.K*(xi_xj)*(ed-nb.value.L)/(double)ed;
     }
     
     Point f_grav = Point(0,0,-grav*mi);
@@ -197,170 +350,1033 @@ struct Problem1Force {
     return spring+f_grav;
   }
 };
+/** What a force term reads from a node. A fused combined_force loads the
+ * union of its terms' fields once per node. */
+enum NodeReads : unsigned {
+	reads_position = 1,	//< n.position()
+	reads_velocity = 2,	//< n.value().vel
+	reads_mass     = 4,	//< n.value().mass
+	reads_edges    = 8	//< incident edges, through the node itself
+};
+
+/** The fields of one node loaded for the force terms that read them */
+template<typename NODE>
+struct NodeState{
+	NODE n;
+	Point x;
+	Point v;
+	double m;
+};
+
+/** Load the fields selected by @a R from node @a n */
+template<unsigned R, typename NODE>
+NodeState<NODE> load_node(NODE n){
+	NodeState<NODE> s;
+	s.n = n;
+	if constexpr ((R & reads_position) != 0)
+		s.x = n.position();
+	if constexpr ((R & (reads_velocity | reads_mass)) != 0){
+		const auto& val = n.value();
+		if constexpr ((R & reads_velocity) != 0)
+			s.v = val.vel;
+		if constexpr ((R & reads_mass) != 0)
+			s.m = val.mass;
+	}
+	return s;
+}
+
+/* Detects force terms that declare their reads and provide eval(state, t) */
+template<typename F, typename = void>
+struct force_reads : std::integral_constant<unsigned, 0> {};
+template<typename F>
+struct force_reads<F, decltype(void(F::reads))> : std::integral_constant<unsigned, F::reads> {};
+
 struct GravityForce{
+  static constexpr unsigned reads = reads_mass;
+  /* Returns the force of gravity applied to the loaded node at time @a t*/
+  template <typename NODE>
+  Point eval(const NodeState<NODE>& s, double t) const {
+	(void) t;
+	return Point(0,0,-grav*s.m);
+  }
   /* Returns the force of gravity applied to @a n at time @a t*/
   template <typename NODE>
   Point operator()(NODE n, double t){
-	(void) t;
-       	double mi = n.value().mass;
-	return Point(0,0,-grav*mi);
+	return eval(load_node<reads>(n), t);
   }
 };
 
 struct MassSpringForce{
-  /* Returns the spring forces applied to @a n at time @a t*/
-  
-  Point operator()(Node n, double t){
+  static constexpr unsigned reads = reads_position | reads_edges;
+  /* Returns the spring forces applied to the loaded node at time @a t*/
+  template <typename NODE>
+  Point eval(const NodeState<NODE>& s, double t) const {
 	(void) t;
  	Point spring = Point(0,0,0);
-    	for (auto it = n.edge_begin(); it!=n.edge_end(); ++it)
-    	{
-		Point p1 = n.position();
-        	Point p2 = (*it).node2().position();
-		if(p1.x==p2.x && p1.y==p2.y && p1.z==p2.z)
-			p2=(*it).node1().position();
-	
-	        double L = (*it).value().L;
-		double K = (*it).value().K;
-	
-	 	Point xi_xj = p1-p2;
+	// Each neighbour straight from the adjacency list, with the value of
+	// the edge to it
+	for (auto nb : s.n.neighbors())
+	{
+	 	Point xi_xj = s.x-nb.position;
         
 		double ed = norm(xi_xj);
-	        spring+=(-1.0)*K*(xi_xj)*(ed-L)/(double)ed;
+	        spring+=(-1.0)*nb.value.K*(xi_xj)*(ed-nb.value.L)/(double)ed;
 	}
 	return spring;
-    }
+  }
+  /* Returns the spring forces applied to @a n at time @a t*/
+  Point operator()(Node n, double t){
+	return eval(load_node<reads>(n), t);
+  }
 };
 struct DampingForce{
-	Point operator()(Node n, double t){
+	static constexpr unsigned reads = reads_velocity;
+	template <typename NODE>
+	Point eval(const NodeState<NODE>& s, double t) const {
 		(void) t;
-		return (-1)*c*n.value().vel;
+		return (-1)*c*s.v;
+	}
+	Point operator()(Node n, double t){
+		return eval(load_node<reads>(n), t);
 	}
 };
-/* Returns a Point, which is the sum of values returned from two functions */
-template<typename Force1, typename Force2>
+/** Returns a Point, which is the sum of the values of all its force terms.
+ *
+ * Terms that declare their reads are fused: the node's fields are loaded
+ * once for the whole sum and every term evaluates from that NodeState.
+ * Terms without reads are called as @a f(n, t). A combined_force declares
+ * the union of its terms' reads, so nested combinations fuse as well. */
+template<typename... Forces>
 struct combined_force{
-	Force1 f1_;
-	Force2 f2_;
-	combined_force(Force1 f1=Force1(), Force2 f2=Force2()):f1_(f1),f2_(f2){}
+	static constexpr unsigned reads = (force_reads<Forces>::value | ... | 0u);
+	std::tuple<Forces...> f_;
+	combined_force(Forces... f):f_(f...){}
+
+	template<typename NODE>
+	Point eval(const NodeState<NODE>& s, double t){
+		return std::apply([&](auto&... f){
+			return (Point(0,0,0) + ... + term(f, s, t));
+		}, f_);
+	}
 	Point operator()(Node n, double t){
-		return f1_(n,t)+f2_(n,t);
+		return eval(load_node<reads>(n), t);
+	}
+
+	/** Batch form: all per-node terms in one sweep, then each batch term.
+	 * Only defined if some term is a batch force, so that a combination of
+	 * per-node terms is still called per node by the integrators. */
+	template<typename G, typename = std::enable_if_t<
+		(is_batch_force<Forces, G>::value || ...)>>
+	void apply(const G& g, double t, PointSpan out){
+		if constexpr ((!is_batch_force<Forces, G>::value || ...)){
+			for(auto it = g.node_begin(); it != g.node_end(); ++it){
+				auto s = load_node<reads>(*it);
+				std::apply([&](auto&... f){
+					((out[s.n.index()] += node_term<G>(f, s, t)), ...);
+				}, f_);
+			}
+		}
+		std::apply([&](auto&... f){ (batch_term<G>(f, g, t, out), ...); }, f_);
+	}
+
+ private:
+	template<typename F, typename NODE>
+	static Point term(F& f, const NodeState<NODE>& s, double t){
+		if constexpr (force_reads<F>::value != 0)
+			return f.eval(s, t);
+		else
+			return f(s.n, t);
+	}
+	template<typename G, typename F, typename NODE>
+	static Point node_term(F& f, const NodeState<NODE>& s, double t){
+		if constexpr (is_batch_force<F, G>::value)
+			return Point(0,0,0);
+		else
+			return term(f, s, t);
+	}
+	template<typename G, typename F>
+	static void batch_term(F& f, const G& g, double t, PointSpan out){
+		if constexpr (is_batch_force<F, G>::value)
+			f.apply(g, t, out);
+	}
+};
+/** Spring forces of all edges as a batch force.
+ * Each spring is evaluated once and added to both of its nodes with
+ * opposite signs, instead of once from each end as in MassSpringForce. */
+struct BatchMassSpringForce{
+	template<typename G>
+	void apply(const G& g, double t, PointSpan out){
+		(void) t;
+		for (auto it = g.edge_begin(); it != g.edge_end(); ++it) {
+			auto e = *it;
+			auto i = e.node1().index();
+			auto j = e.node2().index();
+			Point xi_xj = g.node(i).position() - g.node(j).position();
+			double ed = norm(xi_xj);
+			const EdgeData& ev = e.value();
+			Point f = (-ev.K*(ed - ev.L)/ed)*xi_xj;
+			out[i] += f;
+			out[j] -= f;
+		}
 	}
 };
-/* Combines two functions and returns the sum of their values*/
-template<typename Force1, typename Force2>
-combined_force<Force1,Force2> make_combined_force(Force1 F1, Force2 F2){
-	return combined_force<Force1, Force2>(F1,F2);
+/* Combines any number of functions and returns the sum of their values*/
+template<typename... Forces>
+combined_force<Forces...> make_combined_force(Forces... F){
+	return combined_force<Forces...>(F...);
 }
-/* Combines three functions and returns the sum of their values*/
-template<typename Force1, typename Force2, typename Force3>
-combined_force<combined_force<Force1,Force2>, Force3> make_combined_force(Force1 F1, Force2 F2, Force3 F3){
-	return combined_force<combined_force<Force1, Force2>, Force3>(combined_force<Force1,Force2>(F1,F2),F3);
+
+/** Symplectic Euler step with the spring forces accumulated per edge.
+ * @param[in,out] g      Graph
+ * @param[in]     t      The current time
+ * @param[in]     dt     The time step
+ * @param[in]     force  Force without the springs (gravity, damping), either
+ *                       per-node or a batch force added to the buffer
+ * @param[in]     cons   Constraint functor called once as @a cons(g, t)
+ * @param[in,out] ws     Force accumulation buffer, reused between steps
+ * @return the next time step (@a t + @a dt)
+ *
+ * Same update as symp_euler_step() with MassSpringForce, in three streaming
+ * sweeps: positions are advanced and the force buffer cleared in one node
+ * sweep, every spring is evaluated once per edge and scattered to both
+ * endpoints in one edge sweep, and velocities are updated from the buffer
+ * in a final node sweep. Constraints are applied once, between the
+ * position and the force sweeps.
+ */
+template <typename G, typename F, typename C>
+double fused_step(G& g, double t, double dt, F force, C cons, StepWorkspace& ws) {
+  ws.update(g);
+
+  // x^{n+1} = x^{n} + v^{n} * dt, and clear the force buffer
+  {
+    PROFILE_SCOPE("fused.position");
+    for (auto it = g.node_begin(); it != g.node_end(); ++it) {
+      auto n = *it;
+      n.position() += n.value().vel * dt;
+      ws.force[n.index()] = Point(0,0,0);
+    }
+  }
+
+  {
+    PROFILE_SCOPE("fused.constraints");
+    cons(g, t);
+  }
+
+  // Each spring once, equal and opposite on its two nodes
+  {
+    PROFILE_SCOPE("fused.force");
+    BatchMassSpringForce().apply(g, t, PointSpan(ws.force));
+    if constexpr (is_batch_force<F, G>::value)
+      force.apply(g, t, PointSpan(ws.force));
+  }
+
+  // v^{n+1} = v^{n} + F(x^{n+1},t) * dt / m
+  PROFILE_SCOPE("fused.velocity");
+  for (auto it = g.node_begin(); it != g.node_end(); ++it) {
+    auto n = *it;
+    if(n.position()!=Point(0,0,0) && n.position()!=Point(1,0,0)) {
+      if constexpr (is_batch_force<F, G>::value)
+	n.value().vel += ws.force[n.index()] * (dt / n.value().mass);
+      else
+	n.value().vel += (ws.force[n.index()] + force(n, t)) * (dt / n.value().mass);
+    }
+  }
+  return t + dt;
+}
+
+/** Fixed set of worker threads for fork-join loops.
+ *
+ * The workers are started once and sleep between loops, so a loop costs a
+ * wake-up and a join instead of creating and destroying threads. The
+ * calling thread runs the first chunk of every loop itself.
+ */
+class WorkerPool{
+public:
+	WorkerPool() = default;
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+	~WorkerPool(){ resize(1); }
+
+	/** Number of threads a loop is split over, including the caller. */
+	unsigned size() const { return workers_.size() + 1; }
+
+	/** Start or stop workers so that loops run on @a nthreads threads.
+	 * Must not be called while a loop is running. */
+	void resize(unsigned nthreads){
+		nthreads = std::max(1u, nthreads);
+		if(nthreads == size())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		wake_.notify_all();
+		for(auto& w : workers_)
+			w.join();
+		workers_.clear();
+		stop_ = false;
+		for(unsigned id = 1; id < nthreads; ++id)
+			workers_.emplace_back(&WorkerPool::work, this, id, generation_);
+	}
+
+	/** Runs @a fn(begin, end) over [0, @a n) split into size() contiguous
+	 * chunks and returns when all of them are done. Small loops run inline.
+	 * @a fn must only write to data owned by its own chunk. */
+	template<typename F>
+	void parallel_for(std::size_t n, F fn){
+		unsigned nthreads = size();
+		if(nthreads <= 1 || n < 2*nthreads){
+			fn(std::size_t(0), n);
+			return;
+		}
+		std::size_t chunk = (n + nthreads - 1)/nthreads;
+		std::function<void(unsigned)> job = [&](unsigned id){
+			std::size_t b = id*chunk;
+			if(b < n)
+				fn(b, std::min(n, b+chunk));
+		};
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			job_ = &job;
+			pending_ = workers_.size();
+			++generation_;
+		}
+		wake_.notify_all();
+		job(0);
+		std::unique_lock<std::mutex> lock(mutex_);
+		done_.wait(lock, [&]{ return pending_ == 0; });
+		job_ = nullptr;
+	}
+
+private:
+	void work(unsigned id, std::size_t seen){
+		Profiler::instance().name_thread("worker " + std::to_string(id));
+		std::unique_lock<std::mutex> lock(mutex_);
+		for(;;){
+			wake_.wait(lock, [&]{ return stop_ || generation_ != seen; });
+			if(stop_)
+				return;
+			seen = generation_;
+			auto job = job_;
+			lock.unlock();
+			(*job)(id);
+			lock.lock();
+			if(--pending_ == 0)
+				done_.notify_one();
+		}
+	}
+
+	std::vector<std::thread> workers_;
+	std::mutex mutex_;
+	std::condition_variable wake_;	//< workers: a new loop or stop
+	std::condition_variable done_;	//< caller: all workers finished
+	const std::function<void(unsigned)>* job_ = nullptr;
+	std::size_t generation_ = 0;	//< loops started so far
+	std::size_t pending_ = 0;	//< workers still running the current loop
+	bool stop_ = false;
+};
+
+/** Iteration scheme used by pbd_step() for the edge distance constraints. */
+enum class PBDSolver { gauss_seidel, jacobi };
+
+/** Persistent state of the position-based dynamics solver.
+ *
+ * Holds the flattened distance constraints (one per edge, rest length from
+ * EdgeData::L and compliance 1/EdgeData::K), the inverse masses, the
+ * positions at the start of the step and the XPBD multipliers. The
+ * constraint arrays are rebuilt only when the graph's topology changes,
+ * so they are reused across steps.
+ */
+struct PBDWorkspace{
+	using size_type = unsigned;
+
+	PBDSolver solver = PBDSolver::gauss_seidel;
+	unsigned iterations = 10;	//< constraint sweeps per step
+	unsigned threads = 1;		//< worker threads for the Jacobi sweeps
+	WorkerPool pool;		//< started on the first Jacobi sweep
+	double omega = 1.5;		//< Jacobi over-relaxation factor
+
+	size_type num_nodes = 0;
+	size_type num_edges = 0;
+	std::size_t version = 0;	//< topology version the arrays were built for
+
+	std::vector<Point> x_prev;	//< position at the start of the step
+	std::vector<double> w;		//< inverse mass, 0 for pinned nodes
+	std::vector<size_type> c_i, c_j;	//< constraint endpoints
+	std::vector<double> c_L, c_alpha;	//< rest length and compliance
+	std::vector<double> lambda;	//< accumulated XPBD multipliers
+	std::vector<Point> c_dx;	//< Jacobi: per-constraint correction of c_i
+	std::vector<size_type> n_off;	//< Jacobi: CSR offsets into n_con
+	std::vector<int> n_con;		//< Jacobi: constraint id + 1, negated for c_j
+
+	/** Rebuild the constraint arrays from the edges of @a g. */
+	template<typename G>
+	void build(const G& g){
+		num_nodes = g.node_index_end();
+		num_edges = g.num_edges();
+		version = g.topology_version();
+		// Rebuilds can happen mid-step, when a constraint removes nodes,
+		// so keep the per-node state of the current step
+		x_prev.resize(num_nodes, Point(0,0,0));
+		w.resize(num_nodes, 0);
+		c_i.clear(); c_j.clear(); c_L.clear(); c_alpha.clear();
+		for(auto it = g.edge_begin(); it != g.edge_end(); ++it){
+			auto e = *it;
+			c_i.push_back(e.node1().index());
+			c_j.push_back(e.node2().index());
+			c_L.push_back(e.value().L);
+			c_alpha.push_back(e.value().K > 0 ? 1.0/e.value().K : 0.0);
+		}
+		lambda.assign(c_i.size(), 0);
+		c_dx.assign(c_i.size(), Point(0,0,0));
+
+		// Node -> constraint incidence, signed so each node knows which end it is
+		n_off.assign(num_nodes+1, 0);
+		for(size_type c = 0; c < c_i.size(); ++c){
+			++n_off[c_i[c]+1];
+			++n_off[c_j[c]+1];
+		}
+		for(size_type i = 0; i < num_nodes; ++i)
+			n_off[i+1] += n_off[i];
+		n_con.assign(n_off[num_nodes], 0);
+		std::vector<size_type> fill(n_off.begin(), n_off.end()-1);
+		for(size_type c = 0; c < c_i.size(); ++c){
+			n_con[fill[c_i[c]]++] = c+1;
+			n_con[fill[c_j[c]]++] = -(c+1);
+		}
+	}
+
+	/** Rebuild if the topology of @a g no longer matches the arrays. */
+	template<typename G>
+	void update(const G& g){
+		if(g.topology_version() != version || w.empty())
+			build(g);
+	}
+};
+
+/** Solve one distance constraint @a c in place (Gauss-Seidel / XPBD).
+ * Moves both endpoints along the edge by their inverse-mass share. */
+template<typename G>
+void pbd_solve_edge(G& g, PBDWorkspace& ws, unsigned c, double dt){
+	auto ni = g.node(ws.c_i[c]);
+	auto nj = g.node(ws.c_j[c]);
+	double wsum = ws.w[ws.c_i[c]] + ws.w[ws.c_j[c]];
+	if(wsum == 0)
+		return;
+	Point d = ni.position() - nj.position();
+	double len = norm(d);
+	if(len == 0)
+		return;
+	double alpha = ws.c_alpha[c]/(dt*dt);
+	double dlambda = (-(len - ws.c_L[c]) - alpha*ws.lambda[c])/(wsum + alpha);
+	ws.lambda[c] += dlambda;
+	Point corr = (dlambda/len)*d;
+	ni.position() += ws.w[ws.c_i[c]]*corr;
+	nj.position() -= ws.w[ws.c_j[c]]*corr;
+}
+
+/** Advance the graph by one step of extended position-based dynamics.
+ * @param[in,out] g      Graph
+ * @param[in]     t      The current time
+ * @param[in]     dt     The time step; stable for dt far above the explicit limit
+ * @param[in]     force  External force per node (gravity, damping; no springs)
+ * @param[in]     cons   Constraint functor called as @a cons(g, t)
+ * @param[in,out] ws     Solver configuration and reusable state
+ * @return the next time step (@a t + @a dt)
+ *
+ * Each edge is treated as the distance constraint |x_i - x_j| = L with
+ * compliance 1/K. Positions are predicted from the velocities, the edge
+ * constraints are relaxed for ws.iterations sweeps and, after every sweep,
+ * @a cons projects the positions back onto the plane/sphere constraints.
+ * Velocities are then recovered as (x^{n+1} - x^{n}) / dt.
+ *
+ * With PBDSolver::gauss_seidel edges are solved sequentially in edge order.
+ * With PBDSolver::jacobi every constraint correction is computed from the
+ * same positions and then gathered per node, so both phases write disjoint
+ * data and are split across ws.threads workers.
+ *
+ * Nodes at (0, 0, 0) and (1, 0, 0) get zero inverse mass and stay fixed.
+ */
+template <typename G, typename F, typename C>
+double pbd_step(G& g, double t, double dt, F force, C cons, PBDWorkspace& ws) {
+  ws.update(g);
+
+  // Predict positions from the external forces
+  {
+    PROFILE_SCOPE("pbd.predict");
+    for (auto it = g.node_begin(); it != g.node_end(); ++it) {
+      auto n = *it;
+      auto i = n.index();
+      if(n.position()==Point(0,0,0) || n.position()==Point(1,0,0))
+	ws.w[i] = 0;
+      else
+	ws.w[i] = 1.0/n.value().mass;
+      ws.x_prev[i] = n.position();
+      n.value().vel += force(n, t) * (dt * ws.w[i]);
+      n.position() += n.value().vel * dt;
+    }
+  }
+  std::fill(ws.lambda.begin(), ws.lambda.end(), 0.0);
+
+  unsigned nc = ws.c_i.size();
+  {
+    // The scope times the whole loop and, with counters enabled, counts its
+    // hardware events on this thread; the PhaseClocks split the time only.
+    // Jacobi workers count their own chunks under pbd.jacobi.*
+    PROFILE_SCOPE("pbd.iterate");
+    PhaseClock solve_clock(PROFILE_PHASE("pbd.solve"));
+    PhaseClock cons_clock(PROFILE_PHASE("pbd.constraints"));
+    for (unsigned k = 0; k < ws.iterations; ++k) {
+      solve_clock.start();
+      if (ws.solver == PBDSolver::gauss_seidel) {
+	for (unsigned c = 0; c < nc; ++c)
+		pbd_solve_edge(g, ws, c, dt);
+      }
+      else {
+	double alpha_scale = 1.0/(dt*dt);
+	ws.pool.resize(ws.threads);
+	// Phase 1: per-constraint corrections from the current positions
+	ws.pool.parallel_for(nc, [&](std::size_t b, std::size_t e){
+		PROFILE_SCOPE("pbd.jacobi.correct");
+		for (std::size_t c = b; c < e; ++c) {
+			ws.c_dx[c] = Point(0,0,0);
+			double wsum = ws.w[ws.c_i[c]] + ws.w[ws.c_j[c]];
+			Point d = g.node(ws.c_i[c]).position() - g.node(ws.c_j[c]).position();
+			double len = norm(d);
+			if (wsum == 0 || len == 0)
+				continue;
+			double alpha = ws.c_alpha[c]*alpha_scale;
+			double dlambda = (-(len - ws.c_L[c]) - alpha*ws.lambda[c])/(wsum + alpha);
+			ws.lambda[c] += dlambda;
+			ws.c_dx[c] = (dlambda/len)*d;
+		}
+	});
+	// Phase 2: each node gathers the corrections of its own constraints
+	ws.pool.parallel_for(ws.num_nodes, [&](std::size_t b, std::size_t e){
+		PROFILE_SCOPE("pbd.jacobi.gather");
+		for (std::size_t i = b; i < e; ++i) {
+			unsigned deg = ws.n_off[i+1] - ws.n_off[i];
+			if (ws.w[i] == 0 || deg == 0)
+				continue;
+			Point sum = Point(0,0,0);
+			for (unsigned k = ws.n_off[i]; k < ws.n_off[i+1]; ++k) {
+				int sc = ws.n_con[k];
+				if (sc > 0)
+					sum += ws.c_dx[sc-1];
+				else
+					sum -= ws.c_dx[-sc-1];
+			}
+			g.node(i).position() += (ws.omega*ws.w[i]/deg)*sum;
+		}
+	});
+      }
+      solve_clock.stop();
+      // Plane/sphere constraints act as position projections
+      cons_clock.start();
+      cons(g, t);
+      ws.update(g);
+      nc = ws.c_i.size();
+      cons_clock.stop();
+    }
+  }
+
+  // Recover velocities from the corrected positions
+  PROFILE_SCOPE("pbd.velocity");
+  for (auto it = g.node_begin(); it != g.node_end(); ++it) {
+    auto n = *it;
+    n.value().vel = (n.position() - ws.x_prev[n.index()]) / dt;
+  }
+  return t + dt;
+}
+
+/** Order-dependent checksum of all node positions, for comparing runs.
+ * Returns an FNV-1a hash of the coordinates' bit patterns and adds the
+ * coordinate sums to @a sum. */
+template<typename G>
+std::uint64_t position_checksum(const G& g, Point& sum){
+	std::uint64_t h = 14695981039346656037ull;
+	sum = Point(0,0,0);
+	for(auto it = g.node_begin(); it != g.node_end(); ++it){
+		const Point& x = (*it).position();
+		sum += x;
+		for(int k = 0; k < 3; ++k){
+			std::uint64_t bits;
+			double v = k == 0 ? x.x : (k == 1 ? x.y : x.z);
+			std::memcpy(&bits, &v, sizeof(bits));
+			for(int b = 0; b < 8; ++b){
+				h ^= (bits >> (8*b)) & 0xff;
+				h *= 1099511628211ull;
+			}
+		}
+	}
+	return h;
+}
+
+/** Print the memory @a g holds, by use and per node and edge, and, if
+ * allocations are counted, the allocations @a a made by @a ops operations
+ * of kind @a what. */
+template<typename G>
+void memory_report(const G& g, const char* what, const AllocationCount& a, double ops){
+	auto m = g.memory_usage();
+	auto prec = std::cout.precision(6);
+	std::cout << "memory nodes " << m.nodes << " adjacency " << m.adjacency
+	          << " edge_values " << m.edge_values << " index_maps " << m.index_maps
+	          << " slack " << m.slack << " total " << m.total() << "\n"
+	          << "memory bytes/node " << double(m.total()) / std::max(1u, g.num_nodes())
+	          << " bytes/edge " << double(m.total()) / std::max(1u, g.num_edges()) << "\n";
+	if (AllocationScope::enabled())
+		std::cout << "allocations/" << what << " " << a.allocations / ops
+		          << " bytes/" << what << " " << a.bytes / ops << "\n";
+	std::cout.precision(prec);
+	std::cout << std::flush;
 }
 
 int main(int argc, char** argv)
 {
+  // Optional flags, anywhere among the input files
+  std::vector<std::string> inputs;
+  std::string save_binary;
+  std::string vtk;
+  long vtk_every = 100;
+  bool vtk_ascii = false;
+  bool profile = false;
+  bool perf_counters = false;
+  bool memory = false;
+  std::string profile_trace;
+  std::string checkpoint;
+  long checkpoint_every = 1000;
+  std::string restart;
+  std::string trajectory;
+  long trajectory_every = 1;
+  std::uint32_t trajectory_flags = 0;
+  double trajectory_quantum = 1e-6;
+  unsigned trajectory_keyframe = 64;
+  std::string solver = "euler";
+  double dt = 0.001;
+  long headless_steps = 0;
+  PublishPolicy publish;
+  unsigned io_threads = std::max(1u, std::thread::hardware_concurrency());
+  PBDWorkspace pbd;
+  StepWorkspace step_ws;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.compare(0, 2, "--") != 0)
+      inputs.push_back(arg);
+    else if (arg.compare(0, 9, "--solver=") == 0)
+      solver = arg.substr(9);
+    else if (arg.compare(0, 8, "--iters=") == 0)
+      pbd.iterations = std::stoi(arg.substr(8));
+    else if (arg.compare(0, 10, "--threads=") == 0) {
+      int threads = std::stoi(arg.substr(10));
+      if (threads < 1) {
+        std::cerr << "--threads must be at least 1\n";
+        exit(1);
+      }
+      pbd.threads = threads;
+    }
+    else if (arg.compare(0, 5, "--dt=") == 0)
+      dt = std::stod(arg.substr(5));
+    else if (arg.compare(0, 11, "--headless=") == 0)
+      headless_steps = std::stol(arg.substr(11));
+    else if (arg.compare(0, 13, "--trajectory=") == 0)
+      trajectory = arg.substr(13);
+    else if (arg.compare(0, 19, "--trajectory-every=") == 0)
+      trajectory_every = std::max(1L, std::stol(arg.substr(19)));
+    else if (arg == "--trajectory-vel")
+      trajectory_flags |= TrajectoryWriter::velocities;
+    else if (arg == "--trajectory-f32")
+      trajectory_flags |= TrajectoryWriter::float32;
+    else if (arg == "--trajectory-delta")
+      trajectory_flags |= TrajectoryWriter::delta;
+    else if (arg.compare(0, 21, "--trajectory-quantum=") == 0)
+      trajectory_quantum = std::stod(arg.substr(21));
+    else if (arg.compare(0, 22, "--trajectory-keyframe=") == 0)
+      trajectory_keyframe = std::max(1, std::stoi(arg.substr(22)));
+    else if (arg.compare(0, 6, "--vtk=") == 0)
+      vtk = arg.substr(6);
+    else if (arg.compare(0, 12, "--vtk-every=") == 0)
+      vtk_every = std::max(1L, std::stol(arg.substr(12)));
+    else if (arg == "--vtk-ascii")
+      vtk_ascii = true;
+    else if (arg == "--profile")
+      profile = true;
+    else if (arg == "--perf-counters")
+      perf_counters = true;
+    else if (arg == "--memory")
+      memory = true;
+    else if (arg.compare(0, 16, "--profile-trace=") == 0)
+      profile_trace = arg.substr(16);
+    else if (arg.compare(0, 13, "--checkpoint=") == 0)
+      checkpoint = arg.substr(13);
+    else if (arg.compare(0, 19, "--checkpoint-every=") == 0)
+      checkpoint_every = std::max(1L, std::stol(arg.substr(19)));
+    else if (arg.compare(0, 10, "--restart=") == 0)
+      restart = arg.substr(10);
+    else if (arg.compare(0, 14, "--save-binary=") == 0)
+      save_binary = arg.substr(14);
+    else if (arg.compare(0, 13, "--io-threads=") == 0)
+      io_threads = std::max(1, std::stoi(arg.substr(13)));
+    else if (arg.compare(0, 10, "--publish=") == 0) {
+      if (!publish.parse(arg.substr(10))) {
+        std::cerr << "Unknown publish policy " << arg.substr(10) << "\n";
+        exit(1);
+      }
+    }
+    else {
+      std::cerr << "Unknown option " << arg << "\n";
+      exit(1);
+    }
+  }
+
   // Check arguments
-  if (argc < 3) {
-    std::cerr << "Usage: " << argv[0] << " NODES_FILE TETS_FILE\n";
+  if (inputs.size() > 2 || (inputs.empty() && restart.empty())) {
+    std::cerr << "Usage: " << argv[0]
+              << " NODES_FILE TETS_FILE | GRAPH_FILE | --restart=CHECKPOINT"
+              << " [--solver=euler|batch|fused|pbd|pbd-jacobi] [--iters=N] [--threads=N]"
+              << " [--dt=DT] [--headless=STEPS]"
+              << " [--publish=every:K|hz:RATE|adaptive[:FRACTION]]"
+              << " [--io-threads=N] [--save-binary=GRAPH_FILE]"
+              << " [--trajectory=FILE [--trajectory-every=K] [--trajectory-vel]"
+              << " [--trajectory-f32] [--trajectory-delta [--trajectory-quantum=Q]"
+              << " [--trajectory-keyframe=K]]]"
+              << " [--vtk=BASE [--vtk-every=K] [--vtk-ascii]]"
+              << " [--checkpoint=FILE [--checkpoint-every=K]]"
+              << " [--profile] [--profile-trace=TRACE_JSON] [--perf-counters] [--memory]\n";
     exit(1);
   }
-
   // Construct an empty graph
+  AllocationScope load_allocs;
   GraphType graph;
 
-  // Create a nodes_file from the first input argument
-  std::ifstream nodes_file(argv[1]);
-  // Interpret each line of the nodes_file as a 3D Point and add to the Graph
-  Point p;
-  std::vector<typename GraphType::node_type> nodes;
-  while (CME212::getline_parsed(nodes_file, p))
-    nodes.push_back(graph.add_node(p));
-
-  // Create a tets_file from the second input argument
-  std::ifstream tets_file(argv[2]);
-  // Interpret each line of the tets_file as four ints which refer to nodes
-  std::array<int,4> t;
-  while (CME212::getline_parsed(tets_file, t)) {
-    graph.add_edge(nodes[t[0]], nodes[t[1]]);
-    graph.add_edge(nodes[t[0]], nodes[t[2]]);
-
-    // Diagonal edges: include as of HW2 #2
-    graph.add_edge(nodes[t[0]], nodes[t[3]]);
-    graph.add_edge(nodes[t[1]], nodes[t[2]]);
-
-    graph.add_edge(nodes[t[1]], nodes[t[3]]);
-    graph.add_edge(nodes[t[2]], nodes[t[3]]);
+  // A restart takes the graph, the time and the integrator settings from
+  // the checkpoint, so that it continues exactly where the run left off
+  CheckpointState resume;
+  if (!restart.empty()) {
+    try {
+      load_checkpoint(graph, resume, restart);
+    }
+    catch (const std::exception& e) {
+      std::cerr << e.what() << "\n";
+      exit(1);
+    }
+    solver = std::string(resume.solver, strnlen(resume.solver, sizeof(resume.solver)));
+    dt = resume.dt;
+    pbd.iterations = resume.iterations;
+    pbd.omega = resume.omega;
+    c = resume.damping;
+    inputs.clear();
+  }
+
+  if (solver == "pbd-jacobi")
+    pbd.solver = PBDSolver::jacobi;
+  else if (solver != "pbd" && solver != "euler" && solver != "fused" &&
+           solver != "batch") {
+    std::cerr << "Unknown solver " << solver << "\n";
+    exit(1);
   }
 
-  // HW2 #1 YOUR CODE HERE
-  // Set initial conditions for your nodes, if necessary.
+  if (!restart.empty()) {
+    // Already loaded from the checkpoint
+  }
+  else if (inputs.size() == 1) {
+    // A binary graph file already holds positions and node/edge values
+    if (!graph.load_binary(inputs[0])) {
+      std::cerr << "Cannot load binary graph " << inputs[0] << "\n";
+      exit(1);
+    }
+  }
+  else {
+    // Parse the nodes_file (3D Points) and the tets_file (four node indices
+    // per line, six edges each) in parallel and add them to the Graph
+    try {
+      load_mesh(graph, inputs[0], inputs[1], io_threads);
+    }
+    catch (const std::exception& e) {
+      std::cerr << e.what() << "\n";
+      exit(1);
+    }
 
-   //Initial conditions for node
-  for(auto it = graph.node_begin(); it!=graph.node_end();++it)
-  {
-  	(*it).value().mass = (double)1/graph.num_nodes(); //mass
-	(*it).value().vel = Point(0,0,0);		  //velocity
-	
+    // HW2 #1 YOUR CODE HERE
+    // Set initial conditions for your nodes, if necessary.
+    set_initial_conditions(graph);
   }
-  //Initial conditions for edge
-  for(auto it=graph.edge_begin();it!=graph.edge_end();++it)
-  {
-	(*it).value().L = (*it).length();		//spring rest length
-	(*it).value().K = 100;				//spring constant
+  // The damping constant is fixed by the initial mesh; a restart keeps the
+  // one it was saved with, since num_nodes() drops as nodes are removed
+  if (restart.empty())
+    c = (double)1/graph.num_nodes();	//damping constant
+
+  if (!save_binary.empty() && !graph.save_binary(save_binary)) {
+    std::cerr << "Cannot write binary graph " << save_binary << "\n";
+    exit(1);
   }
-  c = (double)1/graph.num_nodes();	//damping constant
 
   // Print out the stats
   std::cout << graph.num_nodes() << " " << graph.num_edges() << std::endl;
+  if (memory)
+    memory_report(graph, "node", load_allocs.count(), std::max(1u, graph.num_nodes()));
+
+  // Per-phase timing and hardware counters, reported at exit and on SIGUSR1
+  if (profile || !profile_trace.empty() || perf_counters) {
+    Profiler::instance().enable(!profile_trace.empty());
+    if (perf_counters)
+      Profiler::instance().enable_counters();
+    Profiler::report_on_signal(SIGUSR1);
+  }
+  auto print_profile = [&](std::ostream& os) {
+    Profiler::instance().report(os);
+    if (Profiler::instance().counting())
+      Profiler::instance().counters_report(os, graph.num_nodes());
+  };
+  auto profile_report = [&]() {
+    if (!Profiler::instance().enabled())
+      return;
+    print_profile(std::cout);
+    if (!profile_trace.empty() && !Profiler::instance().write_trace(profile_trace))
+      std::cerr << "Cannot write trace " << profile_trace << "\n";
+  };
+
+  // Removals by the constraints can compact the graph in the middle of a
+  // step; the per-node state the solvers keep by index follows it
+  graph.on_compact([&](const GraphType::remap_type& nodes, const GraphType::remap_type&) {
+    GraphType::remap(pbd.x_prev, nodes);
+    GraphType::remap(pbd.w, nodes);
+    GraphType::remap(step_ws.force, nodes);
+  });
+
+  // Advance the graph from t to t + dt with the selected solver
+  auto step = [&](double t) {
+    PROFILE_SCOPE("step");
+    if (solver == "euler") {
+      auto f = make_combined_force(GravityForce(),MassSpringForce(), DampingForce());
+      symp_euler_step(graph, t, dt, f);
+    }
+    else if (solver == "batch") {
+      auto f = make_combined_force(GravityForce(), BatchMassSpringForce(), DampingForce());
+      symp_euler_step(graph, t, dt, f, step_ws);
+    }
+    else if (solver == "fused") {
+      auto f = make_combined_force(GravityForce(), DampingForce());
+      auto c = make_combined_constraint(sphere_constraint2(),plane_constraint());
+      fused_step(graph, t, dt, f, c, step_ws);
+    }
+    else {
+      // Springs are handled as distance constraints by the solver
+      auto f = make_combined_force(GravityForce(), DampingForce());
+      auto c = make_combined_constraint(sphere_constraint2(),plane_constraint());
+      pbd_step(graph, t, dt, f, c, pbd);
+    }
+  };
+
+  // Optional trajectory output, written by its own I/O thread
+  std::unique_ptr<TrajectoryWriter> traj;
+  if (!trajectory.empty()) {
+    try {
+      traj.reset(new TrajectoryWriter(trajectory, trajectory_flags, 16,
+                                      trajectory_quantum, trajectory_keyframe));
+    }
+    catch (const std::exception& e) {
+      std::cerr << e.what() << "\n";
+      exit(1);
+    }
+  }
+  // Optional ParaView time series of snapshots, with the node and edge data
+  std::unique_ptr<VtkWriter> vtk_out;
+  FieldSet<GraphType> vtk_fields;
+  if (!vtk.empty()) {
+    vtk_fields.add_node("velocity", 3, [](const Node& n, double* out) {
+      out[0] = n.value().vel.x;
+      out[1] = n.value().vel.y;
+      out[2] = n.value().vel.z;
+    });
+    vtk_fields.add_node("mass", 1, [](const Node& n, double* out) {
+      out[0] = n.value().mass;
+    });
+    vtk_fields.add_edge("rest_length", 1, [](const Edge& e, double* out) {
+      out[0] = e.value().L;
+    });
+    vtk_fields.add_edge("stiffness", 1, [](const Edge& e, double* out) {
+      out[0] = e.value().K;
+    });
+    try {
+      vtk_out.reset(new VtkWriter(vtk, vtk_ascii));
+    }
+    catch (const std::exception& e) {
+      std::cerr << e.what() << "\n";
+      exit(1);
+    }
+  }
+
+  // Optional periodic checkpoints, also written by their own I/O thread
+  std::unique_ptr<Checkpointer> ckpt;
+  if (!checkpoint.empty())
+    ckpt.reset(new Checkpointer(checkpoint));
+
+  auto vtk_due = [&](long k) { return vtk_out && (k+1) % vtk_every == 0; };
+
+  // Hand the state after step k (now at time t) to the outputs. A VTK frame
+  // is taken from @a frame, a snapshot of that state with the VTK fields
+  // already captured, when one was published for the viewer anyway, rather
+  // than from the graph again. @a frame is only read
+  auto record = [&](long k, double t, const PositionFrame* frame) {
+    PROFILE_SCOPE("output");
+    if (Profiler::report_requested())
+      print_profile(std::cerr);
+    if (traj && (k+1) % trajectory_every == 0)
+      traj->push(graph, t, [](const Node& n) { return n.value().vel; });
+    if (vtk_due(k)) {
+      if (frame)
+        vtk_out->push(*frame);
+      else
+        vtk_out->push(graph, t, vtk_fields);
+    }
+    if (ckpt && (k+1) % checkpoint_every == 0) {
+      CheckpointState s;
+      s.t = t;
+      s.dt = dt;
+      s.step = k+1;
+      std::strncpy(s.solver, solver.c_str(), sizeof(s.solver) - 1);
+      s.iterations = pbd.iterations;
+      s.omega = pbd.omega;
+      s.damping = c;
+      ckpt->save(graph, s);
+    }
+  };
+
+  // Headless: a fixed number of steps as fast as possible, no viewer
+  if (headless_steps > 0) {
+    Profiler::instance().name_thread("simulation");
+    AllocationScope step_allocs;
+    auto start = std::chrono::steady_clock::now();
+    double t = resume.t;
+    // Nodes live at the start of each step, as removals shrink the graph
+    double node_steps = 0;
+    for (long k = resume.step; k < headless_steps; ++k, t += dt) {
+      node_steps += graph.num_nodes();
+      step(t);
+      record(k, t + dt, nullptr);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    long steps = std::max(0L, headless_steps - long(resume.step));
+
+    Point sum;
+    std::uint64_t hash = position_checksum(graph, sum);
+    std::cout << "steps " << steps << " t " << t
+              << " seconds " << elapsed.count() << "\n"
+              << "steps/sec " << steps/elapsed.count() << "\n"
+              << "ns/node-step " << 1e9*elapsed.count()/node_steps << "\n"
+              << std::setprecision(17)
+              << "position sum " << sum.x << " " << sum.y << " " << sum.z << "\n"
+              << "position hash " << std::hex << hash << std::dec << std::endl;
+    if (memory)
+      memory_report(graph, "step", step_allocs.count(), std::max(1L, steps));
+    if (traj) {
+      traj->close();
+      std::cout << "trajectory stalls " << traj->stalls()
+                << " failed " << traj->failed() << std::endl;
+    }
+    if (vtk_out) {
+      vtk_out->close();
+      std::cout << "vtk stalls " << vtk_out->stalls()
+                << " failed " << vtk_out->failed() << std::endl;
+    }
+    if (ckpt) {
+      ckpt->close();
+      std::cout << "checkpoints written " << ckpt->written()
+                << " dropped " << ckpt->dropped()
+                << " failed " << ckpt->failed() << std::endl;
+    }
+    profile_report();
+    return 0;
+  }
+
+  // Node positions are handed to the viewer as snapshots, so the viewer
+  // never reads the graph while the simulation is changing it
+  TripleBuffer<PositionFrame> frames;
+  capture(graph, resume.t, frames.write_buffer());
+  frames.publish();
 
   // Launch the Viewer
   CME212::SFML_Viewer viewer;
-  auto node_map = viewer.empty_node_map(graph);
-
-  viewer.add_nodes(graph.node_begin(), graph.node_end(), node_map);
-  viewer.add_edges(graph.edge_begin(), graph.edge_end(), node_map);
+  std::map<SnapshotNode, unsigned> node_map;
+  frames.acquire();
+  const PositionFrame* shown = &frames.read_buffer();
+  viewer.add_nodes(node_begin(*shown), node_end(*shown), node_map);
+  viewer.add_edges(edge_begin(*shown), edge_end(*shown), node_map);
+  std::size_t viewer_version = shown->version;
 
   viewer.center_view();
 
   // We want viewer interaction and the simulation at the same time
   // Viewer is thread-safe, so launch the simulation in a child thread
-  bool interrupt_sim_thread = false;
+  std::atomic<bool> interrupt_sim_thread(false);
   auto sim_thread = std::thread([&](){
+      Profiler::instance().name_thread("simulation");
 
       // Begin the mass-spring simulation
-      double dt = 0.001;
-      double t_start = 0;
+      double t_start = resume.t;
       double t_end = 5.0;
+      long k = resume.step;
 
-      for (double t = t_start; t < t_end && !interrupt_sim_thread; t += dt) {
+      for (double t = t_start; t < t_end && !interrupt_sim_thread; t += dt, ++k) {
         //std::cout << "t = " << t << std::endl;
-        auto f = make_combined_force(GravityForce(),MassSpringForce(), DampingForce());
-	
-	symp_euler_step(graph, t, dt, f);
-        
-	//Clear the viewer's nodes and edges
-        viewer.clear();
-	node_map.clear();
-	
-        // Update viewer with nodes' new positions and new edges
-        viewer.add_nodes(graph.node_begin(), graph.node_end(), node_map);
-	viewer.add_edges(graph.edge_begin(), graph.edge_end(), node_map);
-        viewer.set_label(t);
-
-        // These lines slow down the animation for small graphs, like grid0_*.
-        // Feel free to remove them or tweak the constants.
-        if (graph.size() < 100)
-          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        step(t);
+
+        // Publish a snapshot when the policy asks for one or a VTK frame
+        // is due, which then shares it; this never waits for the viewer,
+        // and between snapshots the physics runs at full speed
+        PositionFrame* frame = nullptr;
+        if (publish.due(k) || vtk_due(k)) {
+          PROFILE_SCOPE("viewer.publish");
+          auto start = PublishPolicy::clock::now();
+          frame = &frames.write_buffer();
+          capture(graph, t + dt, *frame);
+          if (vtk_due(k))
+            vtk_fields.capture(graph, *frame);
+          frames.publish();
+          publish.published(start);
+        }
+        // The viewer may read the published frame meanwhile; both only read
+        record(k, t + dt, frame);
       }
 
     });  // simulation thread
 
+  // Feed the viewer from the latest complete snapshot
+  auto sync_thread = std::thread([&](){
+      Profiler::instance().name_thread("viewer sync");
+      while (!interrupt_sim_thread) {
+        if (!frames.acquire()) {
+          PROFILE_SCOPE("viewer.sleep");
+          std::this_thread::sleep_for(std::chrono::milliseconds(5));
+          continue;
+        }
+        PROFILE_SCOPE("viewer.sync");
+        shown = &frames.read_buffer();
+        if (shown->version != viewer_version) {
+          //Clear the viewer's nodes and edges
+          viewer.clear();
+          node_map.clear();
+
+          // Update viewer with nodes' new positions and new edges
+          viewer.add_nodes(node_begin(*shown), node_end(*shown), node_map);
+          viewer.add_edges(edge_begin(*shown), edge_end(*shown), node_map);
+          viewer_version = shown->version;
+        }
+        else {
+          // Same nodes and edges: nodes already in node_map only move
+          viewer.add_nodes(node_begin(*shown), node_end(*shown), node_map);
+        }
+        viewer.set_label(shown->t);
+      }
+    });  // viewer sync thread
+
   viewer.event_loop();
 
   // If we return from the event loop, we've killed the window.
   interrupt_sim_thread = true;
   sim_thread.join();
+  sync_thread.join();
+  profile_report();
 
   return 0;
 }
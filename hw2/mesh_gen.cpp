@@ -0,0 +1,252 @@
+/**
+ * @file mesh_gen.cpp
+ * Generator of structured meshes for the mass_spring driver
+ *
+ * @brief Writes a cube or cloth mesh of any resolution as a NODES_FILE /
+ * TETS_FILE pair, as a binary graph file, or both.
+ *
+ * Usage: mesh_gen cube|cloth N OUT [--format=text|binary|both] [--shuffle]
+ *                 [--perturb=A] [--seed=S]
+ *
+ *   cube N    the unit cube [0,1]^3 with N cells per side, each cut into six
+ *             tetrahedra: (N+1)^3 nodes, 6 N^3 tetrahedra
+ *   cloth N   the unit square [0,1]^2 at z = 0 with N cells per side, one
+ *             record per cell holding its four corners (the six edges are
+ *             the sides and both diagonals, as in the grid files):
+ *             (N+1)^2 nodes, N^2 records
+ *
+ * Text output goes to OUT.nodes and OUT.tets, binary output to OUT.graph,
+ * which mass_spring loads directly with the initial conditions already
+ * set. --shuffle writes the nodes and records in random order, like a mesh
+ * from an unstructured mesher. --perturb moves every node by up to A cell
+ * sizes along each axis (in the plane for cloth), except the two corners
+ * mass_spring pins, (0,0,0) and (1,0,0). --seed makes both reproducible.
+ */
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "CME212/Point.hpp"
+
+#include "Graph.hpp"
+#include "MassSpringData.hpp"
+#include "MeshIO.hpp"
+
+
+using GraphType = Graph<NodeData,EdgeData>;
+
+/** A generated mesh: points and node index quadruples. */
+struct Mesh {
+  std::vector<Point> points;
+  std::vector<std::array<unsigned,4>> tets;
+};
+
+/** The unit cube with @a n cells per side, in Kuhn tetrahedra: each cell is
+ * cut along its main diagonal into six tetrahedra, the same way in every
+ * cell, so neighbouring cells share faces. */
+Mesh make_cube(unsigned n) {
+  Mesh m;
+  unsigned s = n + 1;
+  auto id = [s](unsigned x, unsigned y, unsigned z) { return (z * s + y) * s + x; };
+  m.points.reserve(std::size_t(s) * s * s);
+  for (unsigned z = 0; z < s; ++z)
+    for (unsigned y = 0; y < s; ++y)
+      for (unsigned x = 0; x < s; ++x)
+        m.points.emplace_back(double(x) / n, double(y) / n, double(z) / n);
+
+  // One tetrahedron per order of the three axes
+  static const unsigned axes[6][3] = {
+    {0,1,2}, {0,2,1}, {1,0,2}, {1,2,0}, {2,0,1}, {2,1,0}};
+  m.tets.reserve(6 * std::size_t(n) * n * n);
+  for (unsigned z = 0; z < n; ++z)
+    for (unsigned y = 0; y < n; ++y)
+      for (unsigned x = 0; x < n; ++x)
+        for (auto& a : axes) {
+          unsigned c[3] = {x, y, z};
+          std::array<unsigned,4> t;
+          t[0] = id(c[0], c[1], c[2]);
+          for (unsigned k = 0; k < 3; ++k) {
+            ++c[a[k]];
+            t[k+1] = id(c[0], c[1], c[2]);
+          }
+          m.tets.push_back(t);
+        }
+  return m;
+}
+
+/** The unit square at z = 0 with @a n cells per side, one record of four
+ * corners per cell. */
+Mesh make_cloth(unsigned n) {
+  Mesh m;
+  unsigned s = n + 1;
+  m.points.reserve(std::size_t(s) * s);
+  for (unsigned y = 0; y < s; ++y)
+    for (unsigned x = 0; x < s; ++x)
+      m.points.emplace_back(double(x) / n, double(y) / n, 0);
+  m.tets.reserve(std::size_t(n) * n);
+  for (unsigned y = 0; y < n; ++y)
+    for (unsigned x = 0; x < n; ++x) {
+      unsigned i = y * s + x;
+      m.tets.push_back({i, i + 1, i + s, i + s + 1});
+    }
+  return m;
+}
+
+/** Move every node but the pinned corners by up to @a amount along each
+ * axis, and along z only if @a in_z. */
+void perturb(Mesh& m, double amount, bool in_z, std::mt19937_64& rng) {
+  std::uniform_real_distribution<double> u(-amount, amount);
+  for (auto& p : m.points) {
+    if (p == Point(0,0,0) || p == Point(1,0,0))
+      continue;
+    p.x += u(rng);
+    p.y += u(rng);
+    if (in_z)
+      p.z += u(rng);
+  }
+}
+
+/** Put the nodes and the records in random order. */
+void shuffle(Mesh& m, std::mt19937_64& rng) {
+  std::vector<unsigned> perm(m.points.size());
+  std::iota(perm.begin(), perm.end(), 0u);
+  std::shuffle(perm.begin(), perm.end(), rng);
+  std::vector<Point> pts(m.points.size());
+  for (std::size_t i = 0; i < perm.size(); ++i)
+    pts[perm[i]] = m.points[i];
+  m.points.swap(pts);
+  for (auto& t : m.tets)
+    for (auto& i : t)
+      i = perm[i];
+  std::shuffle(m.tets.begin(), m.tets.end(), rng);
+}
+
+/** Buffered writer of text records through std::to_chars. */
+class TextOut {
+ public:
+  explicit TextOut(const std::string& path) : f_(std::fopen(path.c_str(), "w")) {
+    buf_.reserve(1 << 20);
+  }
+  ~TextOut() {
+    close();
+  }
+  template <typename T>
+  void field(T v, char sep) {
+    char s[32];
+    auto r = std::to_chars(s, s + sizeof(s), v);
+    buf_.append(s, r.ptr);
+    buf_ += sep;
+    if (buf_.size() > (1 << 20) - 64)
+      flush();
+  }
+  /** @return true if everything was written */
+  bool close() {
+    if (f_) {
+      flush();
+      ok_ = std::fclose(f_) == 0 && ok_;
+      f_ = nullptr;
+    }
+    return ok_;
+  }
+
+ private:
+  void flush() {
+    if (f_ && std::fwrite(buf_.data(), 1, buf_.size(), f_) != buf_.size())
+      ok_ = false;
+    buf_.clear();
+  }
+  std::FILE* f_;
+  std::string buf_;
+  bool ok_ = f_ != nullptr;
+};
+
+bool write_text(const Mesh& m, const std::string& out) {
+  TextOut nodes(out + ".nodes");
+  for (auto& p : m.points) {
+    nodes.field(p.x, ' ');
+    nodes.field(p.y, ' ');
+    nodes.field(p.z, '\n');
+  }
+  TextOut tets(out + ".tets");
+  for (auto& t : m.tets)
+    for (unsigned k = 0; k < 4; ++k)
+      tets.field(t[k], k < 3 ? ' ' : '\n');
+  return nodes.close() && tets.close();
+}
+
+/** Build the graph as load_mesh() would from the text files and save it. */
+bool write_binary(const Mesh& m, const std::string& out) {
+  GraphType g;
+  auto edges = tet_edges(m.tets, m.points.size());
+  g.reserve(m.points.size(), edges.size());
+  std::vector<typename GraphType::node_type> nodes;
+  nodes.reserve(m.points.size());
+  for (auto& p : m.points)
+    nodes.push_back(g.add_node(p));
+  add_mesh_edges(g, nodes, std::move(edges));
+  set_initial_conditions(g);
+  return g.save_binary(out + ".graph");
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> inputs;
+  std::string format = "text";
+  bool shuffled = false;
+  double amount = 0;
+  std::uint64_t seed = 212;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.compare(0, 2, "--") != 0)
+      inputs.push_back(arg);
+    else if (arg.compare(0, 9, "--format=") == 0)
+      format = arg.substr(9);
+    else if (arg == "--shuffle")
+      shuffled = true;
+    else if (arg.compare(0, 10, "--perturb=") == 0)
+      amount = std::stod(arg.substr(10));
+    else if (arg.compare(0, 7, "--seed=") == 0)
+      seed = std::stoull(arg.substr(7));
+    else {
+      std::cerr << "Unknown option " << arg << "\n";
+      exit(1);
+    }
+  }
+
+  if (inputs.size() != 3 || (inputs[0] != "cube" && inputs[0] != "cloth") ||
+      (format != "text" && format != "binary" && format != "both") ||
+      std::stol(inputs[1]) < 1) {
+    std::cerr << "Usage: " << argv[0] << " cube|cloth N OUT"
+              << " [--format=text|binary|both] [--shuffle] [--perturb=A] [--seed=S]\n";
+    exit(1);
+  }
+  unsigned n = std::stoul(inputs[1]);
+  const std::string& out = inputs[2];
+
+  bool cube = inputs[0] == "cube";
+  Mesh m = cube ? make_cube(n) : make_cloth(n);
+  std::mt19937_64 rng(seed);
+  if (amount > 0)
+    perturb(m, amount / n, cube, rng);
+  if (shuffled)
+    shuffle(m, rng);
+
+  if (format != "binary" && !write_text(m, out)) {
+    std::cerr << "Cannot write " << out << ".nodes and " << out << ".tets\n";
+    exit(1);
+  }
+  if (format != "text" && !write_binary(m, out)) {
+    std::cerr << "Cannot write " << out << ".graph\n";
+    exit(1);
+  }
+  std::cout << m.points.size() << " nodes, " << m.tets.size()
+            << (cube ? " tetrahedra" : " cells") << "\n";
+  return 0;
+}
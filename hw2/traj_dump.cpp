@@ -0,0 +1,161 @@
+/**
+ * @file traj_dump.cpp
+ * Decoder of the trajectory files written by the mass_spring driver
+ *
+ * @brief Reads a trajectory with TrajectoryReader and prints one line per
+ * frame, compares it with another trajectory, or checks its keyframe index.
+ *
+ * Usage: traj_dump FILE [--compare=REF] [--keyframes]
+ *
+ *   FILE          a file written with --trajectory, in any of its modes
+ *   --compare=REF also read REF, which must hold the same frames of the
+ *                 same nodes, and print the largest coordinate difference
+ *                 of the positions and velocities
+ *   --keyframes   seek to every keyframe of a delta-compressed FILE and
+ *                 check that it decodes to the frame read sequentially
+ *
+ * Each frame line is "frame I t T nodes N hash H". H hashes the positions
+ * the way the driver's headless "position hash" does, so the last frame of
+ * a float64 trajectory written every step has the hash the driver prints.
+ * The exit status is 1 if a file cannot be read or a check fails.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "CME212/Point.hpp"
+
+#include "TrajectoryReader.hpp"
+
+
+/** FNV-1a hash of the bytes of the coordinates of @a pts, in order. */
+std::uint64_t points_hash(const std::vector<Point>& pts) {
+  std::uint64_t h = 14695981039346656037ull;
+  for (const Point& x : pts) {
+    for (double v : {x.x, x.y, x.z}) {
+      std::uint64_t bits;
+      std::memcpy(&bits, &v, sizeof(bits));
+      for (int b = 0; b < 8; ++b) {
+        h ^= (bits >> (8*b)) & 0xff;
+        h *= 1099511628211ull;
+      }
+    }
+  }
+  return h;
+}
+
+/** Largest coordinate difference between @a a and @a b, of equal size. */
+double max_difference(const std::vector<Point>& a, const std::vector<Point>& b) {
+  double d = 0;
+  for (std::size_t i = 0; i < a.size(); ++i)
+    d = std::max({d, std::abs(a[i].x - b[i].x), std::abs(a[i].y - b[i].y),
+                  std::abs(a[i].z - b[i].z)});
+  return d;
+}
+
+/** Print every frame of @a path. @return the number of frames */
+long dump(const std::string& path) {
+  TrajectoryReader in(path);
+  TrajectoryFrame f;
+  long k = 0;
+  std::cout << std::setprecision(17);
+  for (; in.next(f); ++k)
+    std::cout << "frame " << k << " t " << f.t << " nodes " << f.ids.size()
+              << " hash " << std::hex << points_hash(f.pos) << std::dec << "\n";
+  return k;
+}
+
+/** Compare the frames of @a path with those of @a ref.
+ * @return false if they differ in number, time or nodes */
+bool compare(const std::string& path, const std::string& ref) {
+  TrajectoryReader a(path), b(ref);
+  TrajectoryFrame fa, fb;
+  double dpos = 0, dvel = 0;
+  long k = 0;
+  for (;; ++k) {
+    bool more = a.next(fa);
+    if (more != b.next(fb)) {
+      std::cerr << path << " and " << ref << " differ in length\n";
+      return false;
+    }
+    if (!more)
+      break;
+    if (fa.t != fb.t || fa.ids != fb.ids || fa.vel.size() != fb.vel.size()) {
+      std::cerr << "frame " << k << " differs in time or nodes\n";
+      return false;
+    }
+    dpos = std::max(dpos, max_difference(fa.pos, fb.pos));
+    dvel = std::max(dvel, max_difference(fa.vel, fb.vel));
+  }
+  std::cout << "frames " << k << " position error " << dpos
+            << " velocity error " << dvel << "\n";
+  return true;
+}
+
+/** Decode every keyframe of @a path through seek() and check it against
+ * the frame read sequentially. @return false on a mismatch */
+bool check_keyframes(const std::string& path) {
+  TrajectoryReader seq(path), rand(path);
+  const auto& index = seq.keyframes();
+  TrajectoryFrame f, g;
+  std::size_t k = 0;
+  while (k < index.size() && seq.next(f)) {
+    if (f.t != index[k].t)
+      continue;
+    rand.seek(k);
+    if (!rand.next(g) || g.t != f.t || g.ids != f.ids || g.pos != f.pos ||
+        g.vel != f.vel) {
+      std::cerr << "keyframe " << k << " at t " << f.t << " decodes differently\n";
+      return false;
+    }
+    ++k;
+  }
+  if (k != index.size()) {
+    std::cerr << "keyframe " << k << " not found reading in order\n";
+    return false;
+  }
+  std::cout << "keyframes " << k << " ok\n";
+  return true;
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> inputs;
+  std::string ref;
+  bool keyframes = false;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.compare(0, 2, "--") != 0)
+      inputs.push_back(arg);
+    else if (arg.compare(0, 10, "--compare=") == 0)
+      ref = arg.substr(10);
+    else if (arg == "--keyframes")
+      keyframes = true;
+    else {
+      std::cerr << "Unknown option " << arg << "\n";
+      exit(1);
+    }
+  }
+  if (inputs.size() != 1) {
+    std::cerr << "Usage: " << argv[0] << " FILE [--compare=REF] [--keyframes]\n";
+    exit(1);
+  }
+
+  try {
+    if (!ref.empty())
+      return compare(inputs[0], ref) ? 0 : 1;
+    if (keyframes)
+      return check_keyframes(inputs[0]) ? 0 : 1;
+    dump(inputs[0]);
+  }
+  catch (const std::exception& e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}